@@ -5,7 +5,37 @@ builder:addFont("Sans24", "C:\\Windows\\Fonts\\msyh.ttc", 0, 32)
 --builder:addFont("Sans24", "SourceHanSansSC-Regular.otf", 0, 24)
 --builder:addFont("Sans24", "HarmonyOS_Sans_SC_Regular.ttf", 0, 24)
 builder:addRange("Sans24", 32, 126)
+--builder:addFont("Symbol24", "C:\\Windows\\Fonts\\seguisym.ttf", 0, 32)
+--builder:addFont("SansMulti", "C:\\Windows\\Fonts\\msyh.ttc", 0, { 12, 16, 24, 32, 48 }) -- one outline load, index grouped per size
+--builder:addFont("Bold24", "C:\\Windows\\Fonts\\bahnschrift.ttf", 0, 24, "Bold") -- named instance of a variable font
+--builder:addFont("Wide24", "C:\\Windows\\Fonts\\bahnschrift.ttf", 0, 24, { wght = 350, wdth = 100 }) -- explicit axis coordinates
+--builder:addFallback("Sans24", "Symbol24") -- missing glyphs of Sans24 are taken from Symbol24
 --builder:addRange("Sans24", 0x4E00, 0x9FFF)
-builder:setImageFileFormat("png")
+--builder:addAvailableRange("Sans24", 0x4E00, 0x9FFF) -- only glyphs present in the font
+--builder:addCodes("Sans24", { 0x3001, 0x3002, 0xFF01 }) -- a whole list in one call
+--builder:addRanges("Sans24", { { 0x3040, 0x309F }, { 0x30A0, 0x30FF } })
+--local kana = fontatlas.CodeSet():addRange(0x3040, 0x30FF):difference(fontatlas.CodeSet({ 0x3040, 0x30A0 }))
+--builder:addCodeSet("Sans24", kana) -- merged by ranges, one set can be added to several fonts
+-- CodeSet: add, addRange, addCodes, addRanges, addText, union, difference, intersect (in place, return the set),
+-- contains, size or #set, ranges() as { { first, last }, ... }, clone, clear
+builder:setImageFileFormat("png") -- "png", "bmp" or "dds"
 builder:setMultiChannelEnable(false)
-builder:build("font/", 256, 256, 1, 0)
+--builder:setKerningEnable(true) -- kerning={first,second,advance, ...} per font, from GPOS or the kern table
+--builder:setMipmapLevels(3) -- glyphs stay separated down to mip 3, dds stores the chain, png/bmp write 1_mip1.png ...
+--builder:setGlyphImageMode("sdf", 4) -- "normal", "sdf" or "msdf", with spread in pixel
+--builder:setStroke("channel", 2, "round") -- "none", "channel" or "separate", width in pixel, "round", "bevel" or "miter"
+--builder:setShadow("channel", 3, 1, 2) -- "none", "channel" or "separate", blur radius and offset (y down) in pixel
+--builder:setMemoryBudget(1024 * 1024 * 1024) -- in bytes, glyph bitmaps beyond it are spilled to font/glyphs.tmp during the build
+--builder:setIncremental(true) -- the next build to "font/" in this process only adds new code points, fontatlas --watch sets it
+--fontatlas.startTrace("build.json") -- chrome trace of the build, open in perfetto or chrome://tracing
+-- one trace runs at a time in the process, startTrace returns false while another config is recording
+local ok, stats = builder:build("font/", 256, 256, 1, 0)
+-- stats: glyphs_rendered, glyphs_missing, pages, fill, wasted_texels, peak_memory (this build), process_peak_memory,
+-- page={ {glyphs,used_texels,fill}, ... }, bytes={png,bmp,dds,index,spilled}, wall_time/cpu_time={face,measure,...} in seconds
+--print(ok, stats.pages, stats.fill, stats.bytes.png)
+-- buildAsync returns at once, the build runs on a worker thread and the builder is busy until it is done:
+--local handle = builder:buildAsync("font/", 256, 256, 1, 0)
+--print(handle:progress()) -- 0 to 1, handle:cancel() stops it at the next glyph batch or page
+--local done, ok, stats = handle:poll() -- done is false while it runs
+--local ok, stats = handle:wait() -- blocks, or yields inside a coroutine until the build is done
+--fontatlas.stopTrace()
@@ -0,0 +1,364 @@
+#include "common.hpp"
+#include "builder.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <filesystem>
+#include <Windows.h>
+
+// stage timing of Builder::build over a matrix of code sets, page sizes and multichannel packing,
+// one json object per line on stdout
+//
+// fontatlas_bench [font] [--face n] [--size px] [--repeat n] [--sets ascii,kana,gb2312,uro] [--pages 512,1024,2048]
+//                 [--trace file.json] [--stress n]
+//
+// the font defaults to data/bench.ttf, any font with CJK coverage gives comparable numbers between commits, the font
+// is not part of the repository so every line carries its path, size and FNV-1a hash, only compare lines whose
+// font_hash and font_size match
+//
+// --stress n builds n different configs of the first code set and page size one after another, then all of them
+// at once on n threads, and checks the files of both runs are identical, the exit code is 1 when they are not
+
+namespace
+{
+    struct CodeSetInfo
+    {
+        const char* name;
+        std::vector<uint32_t> codes;
+    };
+    
+    // cells assigned by GB2312 in EUC bytes, code page 936 is GBK and also decodes the cells GBK added
+    // to these rows and maps the unassigned ones to the private use area
+    struct GB2312Cells
+    {
+        uint8_t lead_first;
+        uint8_t lead_last;
+        uint8_t trail_first;
+        uint8_t trail_last;
+    };
+    constexpr GB2312Cells gb2312_cells_[] = {
+        { 0xA1, 0xA1, 0xA1, 0xFE }, // punctuation
+        { 0xA2, 0xA2, 0xB1, 0xE2 }, // numbers
+        { 0xA2, 0xA2, 0xE5, 0xEE },
+        { 0xA2, 0xA2, 0xF1, 0xFC },
+        { 0xA3, 0xA3, 0xA1, 0xFE }, // fullwidth ascii
+        { 0xA4, 0xA4, 0xA1, 0xF3 }, // hiragana
+        { 0xA5, 0xA5, 0xA1, 0xF6 }, // katakana
+        { 0xA6, 0xA6, 0xA1, 0xB8 }, // greek
+        { 0xA6, 0xA6, 0xC1, 0xD8 },
+        { 0xA7, 0xA7, 0xA1, 0xC1 }, // cyrillic
+        { 0xA7, 0xA7, 0xD1, 0xF1 },
+        { 0xA8, 0xA8, 0xA1, 0xBA }, // pinyin
+        { 0xA8, 0xA8, 0xC5, 0xE9 }, // bopomofo
+        { 0xA9, 0xA9, 0xA4, 0xEF }, // box drawing
+        { 0xB0, 0xD6, 0xA1, 0xFE }, // level 1 hanzi
+        { 0xD7, 0xD7, 0xA1, 0xF9 },
+        { 0xD8, 0xF7, 0xA1, 0xFE }, // level 2 hanzi
+    };
+    
+    // GB2312 level 1 and 2 hanzi plus symbols, decoded from code page 936
+    std::vector<uint32_t> gb2312Codes()
+    {
+        std::vector<uint32_t> codes_;
+        for (auto& cells : gb2312_cells_)
+        {
+            for (uint32_t lead = cells.lead_first; lead <= cells.lead_last; lead += 1)
+            {
+                for (uint32_t trail = cells.trail_first; trail <= cells.trail_last; trail += 1)
+                {
+                    const char mb_[2] = { (char)lead, (char)trail };
+                    wchar_t wc_[2] = {};
+                    if (MultiByteToWideChar(936, MB_ERR_INVALID_CHARS, mb_, 2, wc_, 2) == 1 && wc_[0] != 0
+                        && (wc_[0] < 0xE000 || wc_[0] > 0xF8FF))
+                    {
+                        codes_.push_back((uint32_t)wc_[0]);
+                    }
+                }
+            }
+        }
+        return codes_;
+    }
+    
+    std::vector<uint32_t> rangeCodes(uint32_t a, uint32_t b)
+    {
+        std::vector<uint32_t> codes_;
+        for (uint32_t c = a; c <= b; c += 1)
+        {
+            codes_.push_back(c);
+        }
+        return codes_;
+    }
+    
+    std::vector<std::string> splitList(const char* str)
+    {
+        std::vector<std::string> list_;
+        std::string_view v(str);
+        while (!v.empty())
+        {
+            const size_t n = v.find(',');
+            list_.emplace_back(v.substr(0, n));
+            v = n == std::string_view::npos ? std::string_view() : v.substr(n + 1);
+        }
+        return list_;
+    }
+    
+    bool readFile(const std::filesystem::path& path, std::string& data)
+    {
+        std::ifstream file_(path, std::ios::binary | std::ios::in);
+        if (!file_.is_open())
+        {
+            return false;
+        }
+        data.assign(std::istreambuf_iterator<char>(file_), std::istreambuf_iterator<char>());
+        return true;
+    }
+    
+    // "font":...,"font_size":...,"font_hash":... for every json line, empty when the font can not be read
+    std::string fontJson(const std::string& path, uint32_t size)
+    {
+        std::string data_;
+        if (!readFile(fontatlas::toWide(path), data_))
+        {
+            return std::string();
+        }
+        uint64_t hash_ = 0xCBF29CE484222325ull;
+        for (char c : data_)
+        {
+            hash_ = (hash_ ^ (uint8_t)c) * 0x100000001B3ull;
+        }
+        std::string out_ = "\"font\":\"";
+        for (char c : path)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out_.push_back('\\');
+            }
+            out_.push_back(c);
+        }
+        char buffer_[96] = {};
+        std::snprintf(buffer_, 96, "\",\"font_size\":%u,\"font_hash\":\"%016llx\"", size, (unsigned long long)hash_);
+        out_.append(buffer_);
+        return out_;
+    }
+    
+    // files of a that are missing in b or differ, and files of b that a does not have
+    uint32_t compareDirectory(const std::filesystem::path& a, const std::filesystem::path& b)
+    {
+        uint32_t mismatch_ = 0;
+        uint32_t count_a_ = 0;
+        uint32_t count_b_ = 0;
+        std::error_code ec_;
+        for (auto& entry : std::filesystem::directory_iterator(a, ec_))
+        {
+            count_a_ += 1;
+            std::string data_a_, data_b_;
+            if (!readFile(entry.path(), data_a_) || !readFile(b / entry.path().filename(), data_b_) || data_a_ != data_b_)
+            {
+                std::fprintf(stderr, "mismatch: %s\n", (b / entry.path().filename()).string().c_str());
+                mismatch_ += 1;
+            }
+        }
+        for (auto& entry : std::filesystem::directory_iterator(b, ec_))
+        {
+            (void)entry;
+            count_b_ += 1;
+        }
+        return mismatch_ + (count_b_ > count_a_ ? count_b_ - count_a_ : 0);
+    }
+    
+    int runStress(const std::string& font, const std::string& font_json, uint32_t face, uint32_t size,
+        const CodeSetInfo& set, uint32_t page, uint32_t count, const std::string& out)
+    {
+        // every build differs in size and packing so mixed up state between them shows in the files
+        auto build_ = [&](uint32_t i, const std::string& path)
+        {
+            fontatlas::Builder builder_;
+            builder_.addFont("bench", font, face, size + i);
+            for (uint32_t c : set.codes)
+            {
+                builder_.addCode("bench", c);
+            }
+            builder_.setMultiChannelEnable(i % 2 == 1);
+            return builder_.build(path, page, page, 1, 1);
+        };
+        auto path_ = [&](const char* run, uint32_t i)
+        {
+            return out + run + std::to_string(i) + "/";
+        };
+        using clock_ = std::chrono::steady_clock;
+        const clock_::time_point begin_ = clock_::now();
+        bool ok_ = true;
+        for (uint32_t i = 0; i < count; i += 1)
+        {
+            ok_ = build_(i, path_("sequential", i)) && ok_;
+        }
+        const clock_::time_point middle_ = clock_::now();
+        std::vector<char> result_(count, 0);
+        std::vector<std::thread> thread_;
+        thread_.reserve(count);
+        for (uint32_t i = 0; i < count; i += 1)
+        {
+            thread_.emplace_back([&, i]() { result_[i] = build_(i, path_("concurrent", i)) ? 1 : 0; });
+        }
+        for (auto& t : thread_)
+        {
+            t.join();
+        }
+        const clock_::time_point end_ = clock_::now();
+        uint32_t mismatch_ = 0;
+        for (uint32_t i = 0; i < count; i += 1)
+        {
+            ok_ = ok_ && result_[i] != 0;
+            mismatch_ += compareDirectory(fontatlas::toWide(path_("sequential", i)), fontatlas::toWide(path_("concurrent", i)));
+        }
+        std::printf("{%s,\"stress\":%u,\"codeset\":\"%s\",\"page\":%u,\"ok\":%s,\"identical\":%s,\"mismatched_files\":%u"
+            ",\"sequential_ms\":%.3f,\"concurrent_ms\":%.3f}\n",
+            font_json.c_str(), count, set.name, page, ok_ ? "true" : "false", mismatch_ == 0 ? "true" : "false", mismatch_,
+            std::chrono::duration<double, std::milli>(middle_ - begin_).count(),
+            std::chrono::duration<double, std::milli>(end_ - middle_).count());
+        std::fflush(stdout);
+        return (ok_ && mismatch_ == 0) ? 0 : 1;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    fontatlas::ScopeCoInitialize co;
+    logger::get().setLevel(logger::level::warn);
+    
+    std::string font_ = "data/bench.ttf";
+    uint32_t face_ = 0;
+    uint32_t size_ = 32;
+    uint32_t repeat_ = 3;
+    std::vector<std::string> sets_ = { "ascii", "kana", "gb2312", "uro" };
+    std::vector<uint32_t> pages_ = { 512, 1024, 2048 };
+    std::string trace_;
+    uint32_t stress_ = 0;
+    for (int i = 1; i < argc; i += 1)
+    {
+        if (std::strcmp(argv[i], "--face") == 0 && i + 1 < argc) face_ = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) size_ = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat_ = std::max((uint32_t)std::strtoul(argv[++i], nullptr, 10), 1u);
+        else if (std::strcmp(argv[i], "--sets") == 0 && i + 1 < argc) sets_ = splitList(argv[++i]);
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) trace_ = argv[++i];
+        else if (std::strcmp(argv[i], "--stress") == 0 && i + 1 < argc) stress_ = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--pages") == 0 && i + 1 < argc)
+        {
+            pages_.clear();
+            for (auto& v : splitList(argv[++i]))
+            {
+                pages_.push_back((uint32_t)std::strtoul(v.c_str(), nullptr, 10));
+            }
+        }
+        else font_ = argv[i];
+    }
+    if (!std::filesystem::is_regular_file(fontatlas::toWide(font_)))
+    {
+        std::fprintf(stderr, "font not found: %s\n", font_.c_str());
+        return 1;
+    }
+    const std::string font_json_ = fontJson(font_, size_);
+    if (font_json_.empty())
+    {
+        std::fprintf(stderr, "can not read font: %s\n", font_.c_str());
+        return 1;
+    }
+    
+    std::vector<CodeSetInfo> codesets_;
+    for (auto& name : sets_)
+    {
+        if (name == "ascii") codesets_.push_back({ "ascii", rangeCodes(0x20, 0x7E) });
+        else if (name == "kana") codesets_.push_back({ "kana", rangeCodes(0x3040, 0x30FF) });
+        else if (name == "gb2312") codesets_.push_back({ "gb2312", gb2312Codes() });
+        else if (name == "uro") codesets_.push_back({ "uro", rangeCodes(0x4E00, 0x9FFF) });
+        else std::fprintf(stderr, "unknown code set: %s\n", name.c_str());
+    }
+    
+    const char* stage_name_[(size_t)fontatlas::BuildStage::Count] = {
+        "face", "measure", "raster", "sort", "pack", "blit", "encode", "index",
+    };
+    const std::string out_ = "bench_out/";
+    if (!trace_.empty())
+    {
+        fontatlas::Tracer::get().start(trace_);
+    }
+    if (stress_ > 0)
+    {
+        if (codesets_.empty() || pages_.empty())
+        {
+            std::fprintf(stderr, "stress needs a code set and a page size\n");
+            return 1;
+        }
+        const int ret_ = runStress(font_, font_json_, face_, size_, codesets_[0], pages_[0], stress_, out_);
+        if (!trace_.empty() && !fontatlas::Tracer::get().stop())
+        {
+            std::fprintf(stderr, "can not write %s\n", trace_.c_str());
+        }
+        logger::get().flush();
+        std::error_code ec_;
+        std::filesystem::remove_all(fontatlas::toWide(out_), ec_);
+        return ret_;
+    }
+    for (auto& set : codesets_)
+    {
+        for (uint32_t page : pages_)
+        {
+            for (int multichannel = 0; multichannel < 2; multichannel += 1)
+            {
+                // best of repeat_ by total time, the first run also pays for opening the face
+                double best_[(size_t)fontatlas::BuildStage::Count] = {};
+                double best_total_ = -1.0;
+                bool ok_ = true;
+                for (uint32_t r = 0; r < repeat_ && ok_; r += 1)
+                {
+                    fontatlas::Builder builder_;
+                    builder_.addFont("bench", font_, face_, size_);
+                    for (uint32_t c : set.codes)
+                    {
+                        builder_.addCode("bench", c);
+                    }
+                    builder_.setMultiChannelEnable(multichannel != 0);
+                    ok_ = builder_.build(out_, page, page, 1, 1);
+                    double total_ = 0.0;
+                    for (size_t s = 0; s < (size_t)fontatlas::BuildStage::Count; s += 1)
+                    {
+                        total_ += builder_.stageTime((fontatlas::BuildStage)s);
+                    }
+                    if (best_total_ < 0.0 || total_ < best_total_)
+                    {
+                        best_total_ = total_;
+                        for (size_t s = 0; s < (size_t)fontatlas::BuildStage::Count; s += 1)
+                        {
+                            best_[s] = builder_.stageTime((fontatlas::BuildStage)s);
+                        }
+                    }
+                }
+                std::printf("{%s,\"codeset\":\"%s\",\"codes\":%u,\"page\":%u,\"multichannel\":%s,\"ok\":%s",
+                    font_json_.c_str(), set.name, (uint32_t)set.codes.size(), page, multichannel ? "true" : "false", ok_ ? "true" : "false");
+                for (size_t s = 0; s < (size_t)fontatlas::BuildStage::Count; s += 1)
+                {
+                    std::printf(",\"%s_ms\":%.3f", stage_name_[s], best_[s] * 1000.0);
+                }
+                std::printf(",\"total_ms\":%.3f}\n", best_total_ * 1000.0);
+                std::fflush(stdout);
+            }
+        }
+    }
+    if (!trace_.empty() && !fontatlas::Tracer::get().stop())
+    {
+        std::fprintf(stderr, "can not write %s\n", trace_.c_str());
+    }
+    logger::get().flush();
+    std::error_code ec_;
+    std::filesystem::remove_all(fontatlas::toWide(out_), ec_);
+    return 0;
+}
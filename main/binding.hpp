@@ -1,35 +1,396 @@
 #pragma once
 #include "common.hpp"
 #include "builder.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+#include "parallel.hpp"
+#include "codeset.hpp"
+#include "utf.hpp"
 #include "lua.hpp"
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
 
 namespace fontatlas
 {
     constexpr char lua_module_fontatlas[] = "fontatlas";
     constexpr char lua_class_fontatlas_Builder[] = "fontatlas.Builder";
+    constexpr char lua_class_fontatlas_BuildHandle[] = "fontatlas.BuildHandle";
+    constexpr char lua_class_fontatlas_CodeSet[] = "fontatlas.CodeSet";
+    constexpr char lua_registry_build_failures[] = "fontatlas.buildFailures";
+    constexpr char lua_registry_trace_session[] = "fontatlas.traceSession";
+    
+    // count the failed builds of every builder of the state, build and buildAsync alike, for hosts that
+    // run configs unattended; the counter must outlive the state, lua_close waits for running builds
+    inline void lua_fontatlas_count_failures(lua_State* L, std::atomic<uint32_t>* counter)
+    {
+        lua_pushlightuserdata(L, counter);
+        lua_setfield(L, LUA_REGISTRYINDEX, lua_registry_build_failures);
+    }
+    inline std::atomic<uint32_t>* lua_fontatlas_failure_counter(lua_State* L)
+    {
+        lua_getfield(L, LUA_REGISTRYINDEX, lua_registry_build_failures);
+        auto* counter = static_cast<std::atomic<uint32_t>*>(lua_touserdata(L, -1));
+        lua_pop(L, 1);
+        return counter;
+    }
+    
+    struct CodeSetWrapper
+    {
+        CodeSet* set = nullptr;
+        
+        static CodeSet* luaCast(lua_State* L, int n)
+        {
+            CodeSetWrapper* udata = (CodeSetWrapper*)luaL_checkudata(L, n, lua_class_fontatlas_CodeSet);
+            assert(udata->set);
+            return udata->set;
+        }
+        static int luaRegister(lua_State* L)
+        {
+            const luaL_Reg cls_lib[] = {
+                {"add", &add},
+                {"addRange", &addRange},
+                {"addCodes", &addCodes},
+                {"addRanges", &addRanges},
+                {"addText", &addText},
+                {"union", &union_},
+                {"difference", &difference},
+                {"intersect", &intersect},
+                {"contains", &contains},
+                {"size", &size},
+                {"ranges", &ranges},
+                {"clone", &clone},
+                {"clear", &clear},
+                {NULL, NULL},
+            };
+            const luaL_Reg mt_lib[] = {
+                {"__len", &size},
+                {"__tostring", &__tostring},
+                {"__gc", &__gc},
+                {NULL, NULL},
+            };
+            
+            luaL_newmetatable(L, lua_class_fontatlas_CodeSet);  // ? M mt
+            luaL_setfuncs(L, mt_lib, 0);                        // ? M mt
+            lua_newtable(L);                                    // ? M mt cls
+            luaL_setfuncs(L, cls_lib, 0);                       // ? M mt cls
+            lua_setfield(L, -2, "__index");                     // ? M mt
+            lua_pop(L, 1);                                      // ? M
+            
+            const luaL_Reg M_lib[] = {
+                {"CodeSet", &__create},
+                {NULL, NULL},
+            };
+            
+            luaL_setfuncs(L, M_lib, 0);                         // ? M
+            
+            return 0;
+        }
+        static CodeSet* luaCreate(lua_State* L)
+        {
+            CodeSetWrapper* udata = (CodeSetWrapper*)lua_newuserdata(L, sizeof(CodeSetWrapper));
+            udata->set = new CodeSet;
+            luaL_getmetatable(L, lua_class_fontatlas_CodeSet);
+            lua_setmetatable(L, -2);
+            return udata->set;
+        }
+        
+        // lists are read without metamethods in two passes: check raises the lua errors and runs before
+        // any C++ object is created, since lua errors longjmp past destructors, read can not fail
+        
+        // array of code points
+        static void checkCodes(lua_State* L, int n)
+        {
+            luaL_checktype(L, n, LUA_TTABLE);
+            const lua_Integer count = (lua_Integer)lua_rawlen(L, n);
+            for (lua_Integer i = 1; i <= count; i += 1)
+            {
+                int isnum = 0;
+                lua_rawgeti(L, n, i);
+                lua_tointegerx(L, -1, &isnum);
+                lua_pop(L, 1);
+                if (!isnum)
+                {
+                    luaL_error(L, "code %d of the list is not an integer", (int)i);
+                }
+            }
+        }
+        static void readCodes(lua_State* L, int n, std::vector<uint32_t>& codes)
+        {
+            const lua_Integer count = (lua_Integer)lua_rawlen(L, n);
+            codes.reserve(codes.size() + (size_t)count);
+            for (lua_Integer i = 1; i <= count; i += 1)
+            {
+                lua_rawgeti(L, n, i);
+                codes.push_back((uint32_t)lua_tointeger(L, -1));
+                lua_pop(L, 1);
+            }
+        }
+        // array of { first, last } pairs, last defaults to first
+        static void checkRanges(lua_State* L, int n)
+        {
+            luaL_checktype(L, n, LUA_TTABLE);
+            const lua_Integer count = (lua_Integer)lua_rawlen(L, n);
+            for (lua_Integer i = 1; i <= count; i += 1)
+            {
+                if (lua_rawgeti(L, n, i) != LUA_TTABLE)
+                {
+                    luaL_error(L, "range %d of the list is not a table", (int)i);
+                }
+                int isnum_a = 0;
+                int isnum_b = 1;
+                lua_rawgeti(L, -1, 1);
+                lua_tointegerx(L, -1, &isnum_a);
+                if (lua_rawgeti(L, -2, 2) != LUA_TNIL)
+                {
+                    lua_tointegerx(L, -1, &isnum_b);
+                }
+                lua_pop(L, 3);
+                if (!isnum_a || !isnum_b)
+                {
+                    luaL_error(L, "range %d of the list is not a pair of integers", (int)i);
+                }
+            }
+        }
+        static void readRanges(lua_State* L, int n, CodeSet& set)
+        {
+            const lua_Integer count = (lua_Integer)lua_rawlen(L, n);
+            for (lua_Integer i = 1; i <= count; i += 1)
+            {
+                lua_rawgeti(L, n, i);
+                lua_rawgeti(L, -1, 1);
+                const lua_Integer a = lua_tointeger(L, -1);
+                lua_Integer b = a;
+                if (lua_rawgeti(L, -2, 2) != LUA_TNIL)
+                {
+                    b = lua_tointeger(L, -1);
+                }
+                lua_pop(L, 3);
+                set.add((uint32_t)a, (uint32_t)b);
+            }
+        }
+        
+        static int add(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            self->add((uint32_t)luaL_checkinteger(L, 2));
+            lua_settop(L, 1);
+            return 1;
+        }
+        static int addRange(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            const uint32_t a = (uint32_t)luaL_checkinteger(L, 2);
+            const uint32_t b = (uint32_t)luaL_checkinteger(L, 3);
+            self->add(a, b);
+            lua_settop(L, 1);
+            return 1;
+        }
+        static int addCodes(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            checkCodes(L, 2);
+            std::vector<uint32_t> codes;
+            readCodes(L, 2, codes);
+            self->add(std::move(codes));
+            lua_settop(L, 1);
+            return 1;
+        }
+        static int addRanges(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            checkRanges(L, 2);
+            CodeSet set;
+            readRanges(L, 2, set);
+            self->merge(set);
+            lua_settop(L, 1);
+            return 1;
+        }
+        static int addText(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            size_t text_length = 0;
+            const char* text = luaL_checklstring(L, 2, &text_length);
+            std::vector<uint32_t> codes;
+            char32_t c = 0;
+            utf::utf8reader reader(text, text_length);
+            while (reader(c))
+            {
+                codes.push_back((uint32_t)c);
+            }
+            self->add(std::move(codes));
+            lua_settop(L, 1);
+            return 1;
+        }
+        // set operations change self and return it, clone first to keep the original
+        static int union_(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            self->merge(*luaCast(L, 2));
+            lua_settop(L, 1);
+            return 1;
+        }
+        static int difference(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            self->subtract(*luaCast(L, 2));
+            lua_settop(L, 1);
+            return 1;
+        }
+        static int intersect(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            self->intersect(*luaCast(L, 2));
+            lua_settop(L, 1);
+            return 1;
+        }
+        static int contains(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            lua_pushboolean(L, self->contains((uint32_t)luaL_checkinteger(L, 2)));
+            return 1;
+        }
+        static int size(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            lua_pushinteger(L, (lua_Integer)self->size());
+            return 1;
+        }
+        static int ranges(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            const CodeSet::Range* range = self->rangeData();
+            lua_createtable(L, (int)self->rangeCount(), 0);     // ? t
+            for (size_t i = 0; i < self->rangeCount(); i += 1)
+            {
+                lua_createtable(L, 2, 0);                       // ? t r
+                lua_pushinteger(L, range[i].first);
+                lua_rawseti(L, -2, 1);
+                lua_pushinteger(L, range[i].last);
+                lua_rawseti(L, -2, 2);
+                lua_rawseti(L, -2, (lua_Integer)i + 1);         // ? t
+            }
+            return 1;
+        }
+        static int clone(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            *luaCreate(L) = *self;
+            return 1;
+        }
+        static int clear(lua_State* L)
+        {
+            CodeSet* self = luaCast(L, 1);
+            self->clear();
+            lua_settop(L, 1);
+            return 1;
+        }
+        
+        static int __tostring(lua_State* L)
+        {
+            lua_pushstring(L, lua_class_fontatlas_CodeSet);
+            return 1;
+        };
+        static int __gc(lua_State* L)
+        {
+            CodeSetWrapper* udata = (CodeSetWrapper*)luaL_checkudata(L, 1, lua_class_fontatlas_CodeSet);
+            if (udata->set)
+            {
+                delete udata->set;
+                udata->set = nullptr;
+            }
+            return 0;
+        }
+        
+        // fontatlas.CodeSet([codes])
+        static int __create(lua_State* L)
+        {
+            const bool has_codes = !lua_isnoneornil(L, 1);
+            if (has_codes)
+            {
+                checkCodes(L, 1);
+            }
+            CodeSet* set = luaCreate(L);
+            if (has_codes)
+            {
+                std::vector<uint32_t> codes;
+                readCodes(L, 1, codes);
+                set->add(std::move(codes));
+            }
+            return 1;
+        }
+    };
+    
+    // a build started by buildAsync, shared by the handle, the builder and the worker running it
+    struct BuildJob
+    {
+        Builder* builder = nullptr; // kept alive by the builder userdata until done
+        std::atomic<uint32_t>* failures = nullptr; // of the lua state, if it counts them
+        std::mutex lock;
+        std::condition_variable finished;
+        bool done = false;
+        bool result = false;
+        float progress = 0.0f; // of the builder once done
+        BuildStats stats;
+        
+        bool isDone()
+        {
+            std::scoped_lock lock_(lock);
+            return done;
+        }
+        void wait()
+        {
+            std::unique_lock lock_(lock);
+            finished.wait(lock_, [&]() { return done; });
+        }
+    };
     
     struct BuilderWrapper
     {
         Builder* builder = nullptr;
+        std::shared_ptr<BuildJob> job; // last buildAsync
         
         static Builder* luaCast(lua_State* L, int n)
         {
             BuilderWrapper* udata = (BuilderWrapper*)luaL_checkudata(L, n, lua_class_fontatlas_Builder);
             assert(udata->builder);
+            if (udata->job && !udata->job->isDone())
+            {
+                // the worker owns the builder until the build returns
+                luaL_error(L, "builder is busy with buildAsync");
+            }
             return udata->builder;
         }
         static int luaRegister(lua_State* L)
         {
             const luaL_Reg cls_lib[] = {
                 {"addFont", &addFont},
+                {"addFallback", &addFallback},
                 {"addCode", &addCode},
                 {"addRange", &addRange},
+                {"addCodes", &addCodes},
+                {"addRanges", &addRanges},
+                {"addCodeSet", &addCodeSet},
+                {"addAvailableRange", &addAvailableRange},
                 {"addText", &addText},
                 {"setImageFileFormat", &setImageFileFormat},
                 {"setMultiChannelEnable", &setMultiChannelEnable},
+                {"setMipmapLevels", &setMipmapLevels},
+                {"setKerningEnable", &setKerningEnable},
+                {"setGlyphImageMode", &setGlyphImageMode},
+                {"setStroke", &setStroke},
+                {"setShadow", &setShadow},
+                {"setMemoryBudget", &setMemoryBudget},
+                {"setIncremental", &setIncremental},
                 {"build", &build},
+                {"buildAsync", &buildAsync},
                 {NULL, NULL},
             };
             const luaL_Reg mt_lib[] = {
@@ -56,7 +417,7 @@ namespace fontatlas
         }
         static Builder* luaCreate(lua_State* L)
         {
-            BuilderWrapper* udata = (BuilderWrapper*)lua_newuserdata(L, sizeof(BuilderWrapper));
+            BuilderWrapper* udata = new(lua_newuserdata(L, sizeof(BuilderWrapper))) BuilderWrapper;
             udata->builder = new Builder;
             luaL_getmetatable(L, lua_class_fontatlas_Builder);
             lua_setmetatable(L, -2);
@@ -69,8 +430,101 @@ namespace fontatlas
             const char* name = luaL_checkstring(L, 2);
             const char* path = luaL_checkstring(L, 3);
             const uint32_t face = (uint32_t)luaL_checkinteger(L, 4);
-            const uint32_t size = (uint32_t)luaL_checkinteger(L, 5);
-            const bool ret = self->addFont(name, path, face, size);
+            // one size or a list of sizes, checked before the vector exists, lua errors skip destructors
+            const bool size_list = lua_istable(L, 5);
+            const lua_Integer size_count = size_list ? luaL_len(L, 5) : 1;
+            if (size_list)
+            {
+                for (lua_Integer i = 1; i <= size_count; i += 1)
+                {
+                    lua_geti(L, 5, i);
+                    luaL_checkinteger(L, -1);
+                    lua_pop(L, 1);
+                }
+            }
+            else
+            {
+                luaL_checkinteger(L, 5);
+            }
+            // optional variable font instance: a style name, or a table with instance and axis tags
+            const int variation_type = lua_type(L, 6);
+            if (variation_type == LUA_TTABLE)
+            {
+                lua_pushnil(L);
+                while (lua_next(L, 6) != 0)
+                {
+                    if (lua_type(L, -2) == LUA_TSTRING)
+                    {
+                        if (std::strcmp(lua_tostring(L, -2), "instance") == 0)
+                        {
+                            luaL_checkstring(L, -1);
+                        }
+                        else
+                        {
+                            luaL_checknumber(L, -1);
+                        }
+                    }
+                    lua_pop(L, 1);
+                }
+            }
+            else if (variation_type != LUA_TSTRING && variation_type != LUA_TNONE && variation_type != LUA_TNIL)
+            {
+                return luaL_typeerror(L, 6, "string or table");
+            }
+            std::vector<uint32_t> size;
+            if (size_list)
+            {
+                for (lua_Integer i = 1; i <= size_count; i += 1)
+                {
+                    lua_geti(L, 5, i);
+                    size.push_back((uint32_t)lua_tointeger(L, -1));
+                    lua_pop(L, 1);
+                }
+            }
+            else
+            {
+                size.push_back((uint32_t)lua_tointeger(L, 5));
+            }
+            FontVariation variation;
+            if (variation_type == LUA_TSTRING)
+            {
+                variation.instance = lua_tostring(L, 6);
+            }
+            else if (variation_type == LUA_TTABLE)
+            {
+                lua_pushnil(L);
+                while (lua_next(L, 6) != 0)
+                {
+                    if (lua_type(L, -2) == LUA_TSTRING)
+                    {
+                        const char* key = lua_tostring(L, -2);
+                        if (std::strcmp(key, "instance") == 0)
+                        {
+                            variation.instance = lua_tostring(L, -1);
+                        }
+                        else
+                        {
+                            variation.axis.emplace_back(key, (float)lua_tonumber(L, -1));
+                        }
+                    }
+                    lua_pop(L, 1);
+                }
+            }
+            const bool ret = self->addFont(name, path, face, std::move(size), variation);
+            lua_pushboolean(L, ret);
+            return 1;
+        }
+        static int addFallback(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const char* name = luaL_checkstring(L, 2);
+            const int top = lua_gettop(L);
+            bool ret = true;
+            for (int i = 3; i <= top; i += 1)
+            {
+                const char* fallback = luaL_checkstring(L, i);
+                ret = self->addFallback(name, fallback) && ret;
+            }
             lua_pushboolean(L, ret);
             return 1;
         }
@@ -93,6 +547,48 @@ namespace fontatlas
             lua_pushboolean(L, ret);
             return 1;
         }
+        // one call for a whole list, the table is read natively
+        static int addCodes(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const char* name = luaL_checkstring(L, 2);
+            CodeSetWrapper::checkCodes(L, 3);
+            std::vector<uint32_t> codes;
+            CodeSetWrapper::readCodes(L, 3, codes);
+            const bool ret = self->addCodes(name, std::move(codes));
+            lua_pushboolean(L, ret);
+            return 1;
+        }
+        static int addRanges(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const char* name = luaL_checkstring(L, 2);
+            CodeSetWrapper::checkRanges(L, 3);
+            CodeSet set;
+            CodeSetWrapper::readRanges(L, 3, set);
+            const bool ret = self->addCodeSet(name, set);
+            lua_pushboolean(L, ret);
+            return 1;
+        }
+        static int addCodeSet(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const char* name = luaL_checkstring(L, 2);
+            const CodeSet* set = CodeSetWrapper::luaCast(L, 3);
+            const bool ret = self->addCodeSet(name, *set);
+            lua_pushboolean(L, ret);
+            return 1;
+        }
+        static int addAvailableRange(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const char* name = luaL_checkstring(L, 2);
+            const uint32_t a = (uint32_t)luaL_optinteger(L, 3, 0);
+            const uint32_t b = (uint32_t)luaL_optinteger(L, 4, 0x10FFFF);
+            const bool ret = self->addAvailableRange(name, a, b);
+            lua_pushboolean(L, ret);
+            return 1;
+        }
         static int addText(lua_State* L)
         {
             Builder* self = luaCast(L, 1);
@@ -113,6 +609,10 @@ namespace fontatlas
             {
                 format_v = ImageFileFormat::BMP;
             }
+            else if (std::strncmp(format, "dds", (length < 3) ? length : 3) == 0)
+            {
+                format_v = ImageFileFormat::DDS;
+            }
             self->setImageFileFormat(format_v);
             return 0;
         }
@@ -123,6 +623,65 @@ namespace fontatlas
             self->setMultiChannelEnable(v);
             return 0;
         }
+        static int setKerningEnable(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const bool v = lua_toboolean(L, 2);
+            self->setKerningEnable(v);
+            return 0;
+        }
+        static int setMipmapLevels(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const uint32_t levels = (uint32_t)luaL_checkinteger(L, 2);
+            self->setMipmapLevels(levels);
+            return 0;
+        }
+        static int setGlyphImageMode(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const char* mode_list[] = { "normal", "sdf", "msdf", NULL };
+            const int mode = luaL_checkoption(L, 2, "normal", mode_list);
+            const uint32_t spread = (uint32_t)luaL_optinteger(L, 3, 4);
+            self->setGlyphImageMode((GlyphImageMode)mode, spread);
+            return 0;
+        }
+        static int setStroke(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const char* mode_list[] = { "none", "channel", "separate", NULL };
+            const char* join_list[] = { "round", "bevel", "miter", NULL };
+            const int mode = luaL_checkoption(L, 2, "none", mode_list);
+            const float width = (float)luaL_optnumber(L, 3, 1.0);
+            const int join = luaL_checkoption(L, 4, "round", join_list);
+            self->setStroke((StrokeMode)mode, width, (StrokeJoin)join);
+            return 0;
+        }
+        static int setShadow(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const char* mode_list[] = { "none", "channel", "separate", NULL };
+            const int mode = luaL_checkoption(L, 2, "none", mode_list);
+            const float radius = (float)luaL_optnumber(L, 3, 2.0);
+            const int32_t offset_x = (int32_t)luaL_optinteger(L, 4, 1);
+            const int32_t offset_y = (int32_t)luaL_optinteger(L, 5, 1);
+            self->setShadow((ShadowMode)mode, radius, offset_x, offset_y);
+            return 0;
+        }
+        static int setMemoryBudget(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const lua_Integer bytes = luaL_checkinteger(L, 2);
+            self->setMemoryBudget(bytes > 0 ? (uint64_t)bytes : 0);
+            return 0;
+        }
+        static int setIncremental(lua_State* L)
+        {
+            Builder* self = luaCast(L, 1);
+            const bool v = lua_toboolean(L, 2);
+            self->setIncremental(v);
+            return 0;
+        }
         static int build(lua_State* L)
         {
             Builder* self = luaCast(L, 1);
@@ -134,8 +693,75 @@ namespace fontatlas
             const bool ret = self->build(path,
                 texture_width, texture_height, texture_edge,
                 glyph_edge);
+            std::atomic<uint32_t>* failures = lua_fontatlas_failure_counter(L);
+            if (!ret && failures)
+            {
+                failures->fetch_add(1);
+            }
             lua_pushboolean(L, ret);
-            return 1;
+            pushStats(L, self->stats());
+            return 2;
+        }
+        static int buildAsync(lua_State* L);
+        static void pushStats(lua_State* L, const BuildStats& stats)
+        {
+            const char* stage_name[(size_t)BuildStage::Count] = {
+                "face", "measure", "raster", "sort", "pack", "blit", "encode", "index",
+            };
+            lua_createtable(L, 0, 16);                          // ? t
+            lua_pushinteger(L, stats.glyphs_rendered);
+            lua_setfield(L, -2, "glyphs_rendered");
+            lua_pushinteger(L, stats.glyphs_missing);
+            lua_setfield(L, -2, "glyphs_missing");
+            lua_pushinteger(L, stats.pages);
+            lua_setfield(L, -2, "pages");
+            lua_pushnumber(L, stats.fill);
+            lua_setfield(L, -2, "fill");
+            lua_pushinteger(L, (lua_Integer)stats.wasted_texels);
+            lua_setfield(L, -2, "wasted_texels");
+            lua_pushinteger(L, (lua_Integer)stats.peak_memory);
+            lua_setfield(L, -2, "peak_memory");
+            lua_pushinteger(L, (lua_Integer)stats.process_peak_memory);
+            lua_setfield(L, -2, "process_peak_memory");
+            // page = { { glyphs=, used_texels=, fill= }, ... }
+            lua_createtable(L, (int)stats.page.size(), 0);      // ? t page
+            for (size_t i = 0; i < stats.page.size(); i += 1)
+            {
+                lua_createtable(L, 0, 3);                       // ? t page p
+                lua_pushinteger(L, stats.page[i].glyphs);
+                lua_setfield(L, -2, "glyphs");
+                lua_pushinteger(L, (lua_Integer)stats.page[i].used_texels);
+                lua_setfield(L, -2, "used_texels");
+                lua_pushnumber(L, stats.page[i].fill);
+                lua_setfield(L, -2, "fill");
+                lua_rawseti(L, -2, (lua_Integer)i + 1);         // ? t page
+            }
+            lua_setfield(L, -2, "page");                        // ? t
+            // bytes = { png=, bmp=, dds=, index= }
+            lua_createtable(L, 0, 4);                           // ? t bytes
+            lua_pushinteger(L, (lua_Integer)stats.bytes_png);
+            lua_setfield(L, -2, "png");
+            lua_pushinteger(L, (lua_Integer)stats.bytes_bmp);
+            lua_setfield(L, -2, "bmp");
+            lua_pushinteger(L, (lua_Integer)stats.bytes_dds);
+            lua_setfield(L, -2, "dds");
+            lua_pushinteger(L, (lua_Integer)stats.bytes_index);
+            lua_setfield(L, -2, "index");
+            lua_pushinteger(L, (lua_Integer)stats.bytes_spilled);
+            lua_setfield(L, -2, "spilled");
+            lua_setfield(L, -2, "bytes");                       // ? t
+            // wall_time = { face=, measure=, ... } and cpu_time, in seconds
+            lua_createtable(L, 0, (int)BuildStage::Count);      // ? t wall
+            lua_createtable(L, 0, (int)BuildStage::Count);      // ? t wall cpu
+            for (size_t s = 0; s < (size_t)BuildStage::Count; s += 1)
+            {
+                lua_pushnumber(L, stats.wall_time[s]);
+                lua_setfield(L, -3, stage_name[s]);
+                lua_pushnumber(L, stats.cpu_time[s]);
+                lua_setfield(L, -2, stage_name[s]);
+            }
+            lua_setfield(L, -3, "cpu_time");                    // ? t wall
+            lua_setfield(L, -2, "wall_time");                   // ? t
         }
         
         static int __tostring(lua_State* L)
@@ -146,6 +772,12 @@ namespace fontatlas
         static int __gc(lua_State* L)
         {
             BuilderWrapper* udata = (BuilderWrapper*)luaL_checkudata(L, 1, lua_class_fontatlas_Builder);
+            if (udata->job)
+            {
+                // a dropped builder still finishes its build
+                udata->job->wait();
+                udata->job.reset();
+            }
             if (udata->builder)
             {
                 delete udata->builder;
@@ -161,6 +793,249 @@ namespace fontatlas
         }
     };
     
+    struct BuildHandleWrapper
+    {
+        std::shared_ptr<BuildJob> job;
+        
+        static BuildJob* luaCast(lua_State* L, int n)
+        {
+            BuildHandleWrapper* udata = (BuildHandleWrapper*)luaL_checkudata(L, n, lua_class_fontatlas_BuildHandle);
+            assert(udata->job);
+            return udata->job.get();
+        }
+        static int luaRegister(lua_State* L)
+        {
+            const luaL_Reg cls_lib[] = {
+                {"poll", &poll},
+                {"wait", &wait},
+                {"progress", &progress},
+                {"cancel", &cancel},
+                {NULL, NULL},
+            };
+            const luaL_Reg mt_lib[] = {
+                {"__tostring", &__tostring},
+                {"__gc", &__gc},
+                {NULL, NULL},
+            };
+            
+            luaL_newmetatable(L, lua_class_fontatlas_BuildHandle); // ? M mt
+            luaL_setfuncs(L, mt_lib, 0);                        // ? M mt
+            lua_newtable(L);                                    // ? M mt cls
+            luaL_setfuncs(L, cls_lib, 0);                       // ? M mt cls
+            lua_setfield(L, -2, "__index");                     // ? M mt
+            lua_pop(L, 1);                                      // ? M
+            
+            return 0;
+        }
+        static void luaCreate(lua_State* L, std::shared_ptr<BuildJob> job)
+        {
+            BuildHandleWrapper* udata = new(lua_newuserdata(L, sizeof(BuildHandleWrapper))) BuildHandleWrapper;
+            udata->job = std::move(job);
+            luaL_getmetatable(L, lua_class_fontatlas_BuildHandle);
+            lua_setmetatable(L, -2);
+        }
+        
+        // done, then ok and stats of the build once it returned
+        static int poll(lua_State* L)
+        {
+            BuildJob* self = luaCast(L, 1);
+            if (!self->isDone())
+            {
+                lua_pushboolean(L, false);
+                return 1;
+            }
+            lua_pushboolean(L, true);
+            lua_pushboolean(L, self->result);
+            BuilderWrapper::pushStats(L, self->stats);
+            return 3;
+        }
+        // ok and stats, a coroutine yields until the build is done, the main thread blocks
+        static int wait(lua_State* L)
+        {
+            BuildJob* self = luaCast(L, 1);
+            if (!self->isDone() && lua_isyieldable(L))
+            {
+                return lua_yieldk(L, 0, 0, &waitContinue);
+            }
+            self->wait();
+            lua_pushboolean(L, self->result);
+            BuilderWrapper::pushStats(L, self->stats);
+            return 2;
+        }
+        static int waitContinue(lua_State* L, int status, lua_KContext ctx)
+        {
+            (void)status;
+            (void)ctx;
+            return wait(L);
+        }
+        static int progress(lua_State* L)
+        {
+            BuildJob* self = luaCast(L, 1);
+            std::scoped_lock lock_(self->lock);
+            lua_pushnumber(L, self->done ? self->progress : self->builder->progress());
+            return 1;
+        }
+        // the build returns false at its next glyph batch or page, a queued build right after opening the faces
+        static int cancel(lua_State* L)
+        {
+            BuildJob* self = luaCast(L, 1);
+            std::scoped_lock lock_(self->lock);
+            if (!self->done)
+            {
+                self->builder->setCancel(true);
+            }
+            return 0;
+        }
+        
+        static int __tostring(lua_State* L)
+        {
+            lua_pushstring(L, lua_class_fontatlas_BuildHandle);
+            return 1;
+        };
+        static int __gc(lua_State* L)
+        {
+            // the build goes on, the builder waits for it when collected
+            BuildHandleWrapper* udata = (BuildHandleWrapper*)luaL_checkudata(L, 1, lua_class_fontatlas_BuildHandle);
+            udata->job.reset();
+            return 0;
+        }
+    };
+    
+    // the build runs on the task pool, the builder can not be used from lua until it returns
+    inline int BuilderWrapper::buildAsync(lua_State* L)
+    {
+        Builder* self = luaCast(L, 1);
+        const char* path = luaL_checkstring(L, 2);
+        const uint32_t texture_width = (uint32_t)luaL_checkinteger(L, 3);
+        const uint32_t texture_height = (uint32_t)luaL_checkinteger(L, 4);
+        const uint32_t texture_edge = (uint32_t)luaL_checkinteger(L, 5);
+        const uint32_t glyph_edge = (uint32_t)luaL_checkinteger(L, 6);
+        // C++ objects only after the last check, lua errors skip destructors
+        auto job = std::make_shared<BuildJob>();
+        job->builder = self;
+        job->failures = lua_fontatlas_failure_counter(L);
+        self->setCancel(false);
+        ((BuilderWrapper*)lua_touserdata(L, 1))->job = job;
+        TaskPool::get().submit([=, path_ = std::string(path)]()
+        {
+            const bool ret = job->builder->build(path_,
+                texture_width, texture_height, texture_edge,
+                glyph_edge);
+            if (!ret && job->failures)
+            {
+                job->failures->fetch_add(1);
+            }
+            std::scoped_lock lock_(job->lock);
+            job->result = ret;
+            job->progress = job->builder->progress();
+            job->stats = job->builder->stats();
+            // a cancel that came too late must not stop the next build
+            job->builder->setCancel(false);
+            job->done = true;
+            job->finished.notify_all();
+        });
+        BuildHandleWrapper::luaCreate(L, std::move(job));
+        return 1;
+    }
+    
+    struct LoggerWrapper
+    {
+        static int luaRegister(lua_State* L)
+        {
+            const luaL_Reg M_lib[] = {
+                {"setLogLevel", &setLogLevel},
+                {"setLogFlushPolicy", &setLogFlushPolicy},
+                {NULL, NULL},
+            };
+            
+            luaL_setfuncs(L, M_lib, 0);                         // ? M
+            
+            return 0;
+        }
+        
+        static int setLogLevel(lua_State* L)
+        {
+            const char* level_list[] = { "debug", "info", "warn", "error", "fatal", NULL };
+            const int level = luaL_checkoption(L, 1, "info", level_list);
+            logger::get().setLevel((logger::level)level);
+            return 0;
+        }
+        static int setLogFlushPolicy(lua_State* L)
+        {
+            const uint32_t interval_ms = (uint32_t)luaL_checkinteger(L, 1);
+            const size_t size = (size_t)luaL_checkinteger(L, 2);
+            logger::get().setFlushPolicy(interval_ms, size);
+            return 0;
+        }
+    };
+    
+    struct TracerWrapper
+    {
+        static int luaRegister(lua_State* L)
+        {
+            const luaL_Reg M_lib[] = {
+                {"startTrace", &startTrace},
+                {"stopTrace", &stopTrace},
+                {NULL, NULL},
+            };
+            
+            luaL_setfuncs(L, M_lib, 0);                         // ? M
+            
+            return 0;
+        }
+        
+        // the session belongs to the main thread of the state, coroutines can stop it, other states can not
+        static const void* owner(lua_State* L)
+        {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+            const void* main = lua_tothread(L, -1);
+            lua_pop(L, 1);
+            return main;
+        }
+        static int startTrace(lua_State* L)
+        {
+            const char* path = luaL_checkstring(L, 1);
+            const bool ret = Tracer::get().start(path, owner(L));
+            if (ret)
+            {
+                // a state closed while recording stops its session, else no later trace could start
+                bool* active = (bool*)lua_newuserdata(L, sizeof(bool));
+                *active = true;
+                lua_newtable(L);
+                lua_pushcfunction(L, &sessionGC);
+                lua_setfield(L, -2, "__gc");
+                lua_setmetatable(L, -2);
+                lua_setfield(L, LUA_REGISTRYINDEX, lua_registry_trace_session);
+            }
+            lua_pushboolean(L, ret);
+            return 1;
+        }
+        static int stopTrace(lua_State* L)
+        {
+            const bool ret = Tracer::get().stop(owner(L));
+            if (ret)
+            {
+                if (lua_getfield(L, LUA_REGISTRYINDEX, lua_registry_trace_session) == LUA_TUSERDATA)
+                {
+                    *(bool*)lua_touserdata(L, -1) = false;
+                }
+                lua_pop(L, 1);
+                lua_pushnil(L);
+                lua_setfield(L, LUA_REGISTRYINDEX, lua_registry_trace_session);
+            }
+            lua_pushboolean(L, ret);
+            return 1;
+        }
+        static int sessionGC(lua_State* L)
+        {
+            if (*(bool*)lua_touserdata(L, 1))
+            {
+                Tracer::get().stop(owner(L));
+            }
+            return 0;
+        }
+    };
+    
     int lua_fontatlas_open(lua_State* L)
     {
         struct Wrapper
@@ -173,38 +1048,50 @@ namespace fontatlas
         };
         luaL_requiref(L, lua_module_fontatlas, &Wrapper::__require, true);
         BuilderWrapper::luaRegister(L);
+        BuildHandleWrapper::luaRegister(L);
+        CodeSetWrapper::luaRegister(L);
+        LoggerWrapper::luaRegister(L);
+        TracerWrapper::luaRegister(L);
         return 1;
     }
     
-    static lua_State* GL = NULL;
     static int lua_stack_traceback(lua_State *L)
     {
-        // errmsg
-        luaL_traceback(GL, L, lua_tostring(L, 1), 1);
+        // errmsg, the handler runs on the state that raised the error,
+        // so every thread with its own state gets its own traceback
+        luaL_traceback(L, L, lua_tostring(L, 1), 1);
         return 1;
     }
     
-    void lua_safe_dofile(lua_State* L, const std::string_view path)
+    // run a lua file, nresults values are left on the stack when it succeeds
+    bool lua_safe_dofile(lua_State* L, const std::string_view path, int nresults = 0)
     {
-        GL = L;
+        if (!std::filesystem::is_regular_file(toWide(path)))
+        {
+            std::printf("can not open %.*s\n", (int)path.size(), path.data());
+            return false;
+        }
         lua_pushcfunction(L, &lua_stack_traceback);
         const int funindex = lua_gettop(L);
         Buffer data = std::move(readFile(path));
-        const int loadret = luaL_loadbuffer(L, (char*)data.data(), data.size(), path.data());
+        const std::string chunkname(path);
+        const int loadret = luaL_loadbuffer(L, (char*)data.data(), data.size(), chunkname.c_str());
         if (loadret != LUA_OK)
         {
             const std::string_view errmsg = lua_tostring(L, -1);
             std::printf("%s\n", errmsg.data());
-            lua_pop(L, 1);
-            return;
+            lua_pop(L, 2);
+            return false;
         }
-        const int callret = lua_pcall(L, 0, 0, funindex);
+        const int callret = lua_pcall(L, 0, nresults, funindex);
         if (callret != LUA_OK)
         {
             const std::string_view errmsg = lua_tostring(L, -1);
             std::printf("%s\n", errmsg.data());
-            lua_pop(L, 1);
-            return;
+            lua_pop(L, 2);
+            return false;
         }
+        lua_remove(L, funindex);
+        return true;
     }
 }
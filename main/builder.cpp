@@ -1,20 +1,102 @@
 #include "builder.hpp"
 #include "common.hpp"
+#include "fontcache.hpp"
+#include "raster.hpp"
+#include "kerning.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
 #include "logger.hpp"
 #include "texture.hpp"
 #include "utf.hpp"
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
 #include "ft2build.h"
 #include FT_FREETYPE_H
 
 namespace fontatlas
 {
+    // one glyph image of a build, from code point to its place on the atlas
+    struct GlyphInfo
+    {
+        // basic
+        uint32_t code;
+        uint32_t width;
+        uint32_t height;
+        uint32_t font;
+        uint32_t source; // font actually rendered, differs from font when resolved by fallback
+        uint32_t index;  // glyph index in source font
+        uint32_t size;   // index in font size list
+        uint32_t image;  // index in imagelist_
+        uint32_t layer;  // 0 fill, 1 stroke, 2 shadow
+        // on texture
+        uint32_t texture;
+        uint32_t channel;
+        float uv_x;
+        float uv_y;
+        float uv_width;
+        float uv_height;
+        // on drawing
+        float draw_width;
+        float draw_height;
+        float h_pen_x;
+        float h_pen_y;
+        float h_advance;
+        float v_pen_x;
+        float v_pen_y;
+        float v_advance;
+    };
+    
+    // layout left by an incremental build, the next build to the same path with the same settings
+    // continues on its last page and only renders code points that were not requested before
+    struct IncrementalState
+    {
+        std::string settings;
+        std::vector<CodeSet> code; // requested code points by font, missing ones included
+        std::vector<GlyphInfo> glyph;
+        Texture page{ 0, 0 }; // last page, the next glyphs are packed after the cursor
+        uint32_t image = 1;
+        uint32_t x = 0;
+        uint32_t y = 0;
+        uint32_t down = 0;
+        uint32_t channel = 0;
+        uint32_t page_glyphs = 0;
+        uint64_t page_texels = 0;
+    };
+    static std::mutex incremental_lock_;
+    static std::unordered_map<std::string, std::shared_ptr<const IncrementalState>> incremental_state_;
+    // output paths of the running builds, two builds writing the same files would corrupt each other
+    static std::mutex active_lock_;
+    static std::unordered_set<std::string> active_path_;
+    
     bool Builder::addFont(const std::string_view name, const std::string_view path, uint32_t face, uint32_t size)
     {
-        if (!std::filesystem::is_regular_file(toWide(path)))
+        return addFont(name, path, face, std::vector<uint32_t>{ size });
+    }
+    bool Builder::addFont(const std::string_view name, const std::string_view path, uint32_t face, std::vector<uint32_t> size)
+    {
+        return addFont(name, path, face, std::move(size), FontVariation());
+    }
+    bool Builder::addFont(const std::string_view name, const std::string_view path, uint32_t face, std::vector<uint32_t> size,
+        const FontVariation& variation)
+    {
+        // sizes are kept in the given order without duplicates, the first one is the main size
+        std::vector<uint32_t> size_;
+        for (uint32_t v : size)
+        {
+            if (v > 0 && std::find(size_.begin(), size_.end(), v) == size_.end())
+            {
+                size_.push_back(v);
+            }
+        }
+        if (size_.empty() || !std::filesystem::is_regular_file(toWide(path)))
         {
             return false;
         }
@@ -24,7 +106,21 @@ namespace fontatlas
         cfg_.name = name;
         cfg_.path = path;
         cfg_.face = face;
-        cfg_.size = size;
+        cfg_.size = std::move(size_);
+        {
+            // several instances of one file are separate cache entries over the same file data
+            FontCache::FaceSource source_;
+            source_.path = path;
+            source_.face = face;
+            source_.instance = variation.instance;
+            for (auto& v : variation.axis)
+            {
+                char tag_[4] = { ' ', ' ', ' ', ' ' };
+                std::memcpy(tag_, v.first.data(), std::min<size_t>(v.first.size(), 4));
+                source_.axis.emplace_back(FT_MAKE_TAG(tag_[0], tag_[1], tag_[2], tag_[3]), v.second);
+            }
+            cfg_.id = FontCache::get().faceID(source_);
+        }
         if (_font.find(name_) == _font.end())
         {
             _font.emplace(name_, std::move(cfg_));
@@ -34,38 +130,83 @@ namespace fontatlas
         }
         return false;
     }
+    bool Builder::addFallback(const std::string_view name, const std::string_view fallback)
+    {
+        std::string name_;
+        name_ = name;
+        auto it = _font.find(name_);
+        if (it != _font.end() && name != fallback)
+        {
+            it->second.fallback.emplace_back(fallback);
+            return true;
+        }
+        return false;
+    }
     bool Builder::addCode(const std::string_view name, uint32_t c)
     {
         return addRange(name, c, c);
     }
     bool Builder::addRange(const std::string_view name, uint32_t a, uint32_t b)
     {
-        std::string name_;
-        name_ = name;
-        auto it = _font.find(name_);
+        auto it = _font.find(name);
         if (it != _font.end())
         {
-            for (uint32_t c = a; c <= b; c += 1)
+            it->second.code.add(a, b);
+            return true;
+        }
+        return false;
+    }
+    bool Builder::addCodes(const std::string_view name, std::vector<uint32_t> codes)
+    {
+        auto it = _font.find(name);
+        if (it != _font.end())
+        {
+            it->second.code.add(std::move(codes));
+            return true;
+        }
+        return false;
+    }
+    bool Builder::addCodeSet(const std::string_view name, const CodeSet& set)
+    {
+        auto it = _font.find(name);
+        if (it != _font.end())
+        {
+            it->second.code.merge(set);
+            return true;
+        }
+        return false;
+    }
+    bool Builder::addAvailableRange(const std::string_view name, uint32_t a, uint32_t b)
+    {
+        auto it = _font.find(name);
+        if (it != _font.end())
+        {
+            auto charset_ = FontCache::get().charset(it->second.id);
+            if (!charset_)
             {
-                it->second.code.insert(c);
+                return false;
             }
+            CodeSet set_;
+            set_.add(a, b);
+            set_.intersect(*charset_);
+            it->second.code.merge(set_);
             return true;
         }
         return false;
     }
     bool Builder::addText(const std::string_view name, const std::string_view text)
     {
-        std::string name_;
-        name_ = name;
-        auto it = _font.find(name_);
+        auto it = _font.find(name);
         if (it != _font.end())
         {
+            std::vector<uint32_t> code_;
             char32_t c = 0;
             utf::utf8reader reader(text.data(), text.size());
             while (reader(c))
             {
-                it->second.code.insert((uint32_t)c);
+                code_.push_back((uint32_t)c);
             }
+            it->second.code.add(std::move(code_));
             return true;
         }
         return false;
@@ -78,110 +219,743 @@ namespace fontatlas
     {
         _multichannel = v;
     }
+    void Builder::setKerningEnable(bool v)
+    {
+        _kerning = v;
+    }
+    void Builder::setMipmapLevels(uint32_t levels)
+    {
+        _miplevels = std::min(levels, 15u);
+    }
+    void Builder::setGlyphImageMode(GlyphImageMode mode, uint32_t spread)
+    {
+        _imagemode = mode;
+        _spread = std::max(spread, 1u);
+    }
+    void Builder::setStroke(StrokeMode mode, float width, StrokeJoin join)
+    {
+        _strokemode = mode;
+        _strokewidth = std::max(width, 0.0f);
+        _strokejoin = join;
+    }
+    void Builder::setShadow(ShadowMode mode, float radius, int32_t offset_x, int32_t offset_y)
+    {
+        _shadowmode = mode;
+        _shadowradius = std::max(radius, 0.0f);
+        _shadowoffsetx = offset_x;
+        _shadowoffsety = offset_y;
+    }
+    void Builder::setIncremental(bool v)
+    {
+        _incremental = v;
+    }
+    void Builder::setMemoryBudget(uint64_t bytes)
+    {
+        _memorybudget = bytes;
+    }
+    double Builder::stageTime(BuildStage stage)
+    {
+        return (size_t)stage < (size_t)BuildStage::Count ? _stats.wall_time[(size_t)stage] : 0.0;
+    }
+    const BuildStats& Builder::stats()
+    {
+        return _stats;
+    }
+    float Builder::progress()
+    {
+        return _progress.load(std::memory_order_relaxed);
+    }
+    void Builder::setCancel(bool v)
+    {
+        _cancel.store(v, std::memory_order_relaxed);
+    }
     bool Builder::build(const std::string_view path,
         uint32_t texture_width, uint32_t texture_height, uint32_t texture_edge,
         uint32_t glyph_edge)
     {
-        struct Wrapper
+        FT_Error fterr_ = 0;
+        
+        // time of each stage, measured from the end of the previous one
+        using clock_ = std::chrono::steady_clock;
+        _stats = BuildStats();
+        clock_::time_point stage_begin_ = clock_::now();
+        double stage_cpu_begin_ = processCpuTime();
+        Tracer& tracer_ = Tracer::get();
+        TraceScope trace_build_("build", "build %.*s", (int)path.size(), path.data());
+        double stage_trace_begin_ = tracer_.enabled() ? tracer_.now() : 0.0;
+        const char* stage_name_[(size_t)BuildStage::Count] = {
+            "face", "measure", "raster", "sort", "pack", "blit", "encode", "index",
+        };
+        auto seconds_ = [](clock_::time_point a, clock_::time_point b)
+        {
+            return std::chrono::duration<double>(b - a).count();
+        };
+        auto stage_end_ = [&](BuildStage stage)
         {
-            FT_Library library = NULL;
-            std::vector<FT_Face> face;
-            
-            ~Wrapper()
+            const clock_::time_point now_ = clock_::now();
+            const double cpu_now_ = processCpuTime();
+            _stats.wall_time[(size_t)stage] += seconds_(stage_begin_, now_);
+            _stats.cpu_time[(size_t)stage] += cpu_now_ - stage_cpu_begin_;
+            stage_begin_ = now_;
+            stage_cpu_begin_ = cpu_now_;
+            if (tracer_.enabled())
             {
-                for (auto& f : face)
-                {
-                    if (f)
-                    {
-                        FT_Done_Face(f);
-                        f = NULL;
-                    }
-                }
-                face.clear();
-                if (library)
+                const double trace_now_ = tracer_.now();
+                tracer_.complete("stage", stage_name_[(size_t)stage], stage_trace_begin_, trace_now_);
+                stage_trace_begin_ = trace_now_;
+            }
+        };
+        // face and measure take the first 5%, raster up to 60%, packing with blit and encode up to 95%,
+        // progress only moves forward since the effect workers report out of order
+        _progress.store(0.0f, std::memory_order_relaxed);
+        auto progress_ = [&](float v)
+        {
+            float p_ = _progress.load(std::memory_order_relaxed);
+            while (p_ < v && !_progress.compare_exchange_weak(p_, v, std::memory_order_relaxed))
+            {
+            }
+        };
+        // checked between stages, loops only test the flag and leave early
+        auto cancelled_ = [&]()
+        {
+            if (!_cancel.load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+            logger::warn("build of %.*s cancelled\n", (int)path.size(), path.data());
+            return true;
+        };
+        // bytes of a written file, by format
+        auto count_bytes_ = [&](const char* file, ImageFileFormat format)
+        {
+            std::error_code ec_;
+            const uint64_t size_ = (uint64_t)std::filesystem::file_size(toWide(file), ec_);
+            if (ec_)
+            {
+                return;
+            }
+            switch (format)
+            {
+            case ImageFileFormat::BMP: _stats.bytes_bmp += size_; break;
+            case ImageFileFormat::DDS: _stats.bytes_dds += size_; break;
+            case ImageFileFormat::PNG:
+            default: _stats.bytes_png += size_; break;
+            }
+        };
+        
+        // builders run concurrently only on different paths
+        struct ActivePath
+        {
+            std::string path;
+            bool owned = false;
+            ActivePath(const std::string_view p) : path(p)
+            {
+                std::scoped_lock lock_(active_lock_);
+                owned = active_path_.insert(path).second;
+            }
+            ~ActivePath()
+            {
+                if (owned)
                 {
-                    FT_Done_FreeType(library);
-                    library = NULL;
+                    std::scoped_lock lock_(active_lock_);
+                    active_path_.erase(path);
                 }
             }
         };
-        FT_Error fterr_ = 0;
-        Wrapper  ft_;
+        ActivePath active_(path);
+        if (!active_.owned)
+        {
+            logger::error("%.*s is being built by another builder\n", (int)path.size(), path.data());
+            return false;
+        }
         
-        // open freetype
-        fterr_ = FT_Init_FreeType(&ft_.library);
-        if (fterr_ != FT_Err_Ok)
+        // lease a cached freetype context
+        FontCache::Lease ft_ = FontCache::get().acquire();
+        if (!ft_)
         {
             return false;
         }
         
-        // create all face
-        for (auto v : _fontlist)
+        // check all face, the face and size objects are owned by the cache
+        // pixel size of the k-th size of font, a fallback source keeps its own scale relative to the main size
+        auto pixel_size_ = [&](uint32_t font, uint32_t source, uint32_t k) -> uint32_t
         {
-            ft_.face.push_back(NULL);
-            FT_Face& ftface_ = ft_.face.back();
-            fterr_ = FT_New_Face(ft_.library, v->path.c_str(), v->face, &ftface_);
-            if (fterr_ != FT_Err_Ok)
+            const auto& size_ = _fontlist[font]->size;
+            if (font == source)
             {
-                return false;
+                return size_[k];
             }
-            fterr_ = FT_Set_Char_Size(ftface_, v->size * 64, v->size * 64, 72, 72);
-            if (fterr_ != FT_Err_Ok)
+            const uint64_t v = (uint64_t)_fontlist[source]->size[0] * size_[k];
+            return std::max((uint32_t)((v + size_[0] / 2) / size_[0]), 1u);
+        };
+        auto face_ = [&](uint32_t idx, uint32_t px) -> FT_Face
+        {
+            return ft_->size(_fontlist[idx]->id, px);
+        };
+        for (uint32_t idx = 0; idx < _fontlist.size(); idx += 1)
+        {
+            for (uint32_t px : _fontlist[idx]->size)
             {
-                return false;
+                if (face_(idx, px) == NULL)
+                {
+                    return false;
+                }
             }
         }
+        stage_end_(BuildStage::Face);
+        progress_(0.02f);
+        if (cancelled_())
+        {
+            return false;
+        }
+        
+        // an incremental build continues the previous layout when every setting and font file is the same
+        // and no code point was dropped, anything else is a full build
+        const std::string state_key_(path);
+        std::string settings_;
+        std::shared_ptr<const IncrementalState> previous_;
+        if (_incremental)
+        {
+            char setbuf_[512] = {};
+            std::snprintf(setbuf_, 512, "%u %u %u %u|%d %d %u %d|%d %u|%d %g %d|%d %g %d %d",
+                texture_width, texture_height, texture_edge, glyph_edge,
+                (int)_fileformat, _multichannel ? 1 : 0, _miplevels, _kerning ? 1 : 0,
+                (int)_imagemode, _spread,
+                (int)_strokemode, _strokewidth, (int)_strokejoin,
+                (int)_shadowmode, _shadowradius, _shadowoffsetx, _shadowoffsety);
+            settings_ = setbuf_;
+            for (auto* v : _fontlist)
+            {
+                std::error_code ec_;
+                const auto time_ = std::filesystem::last_write_time(toWide(v->path), ec_);
+                std::snprintf(setbuf_, 512, "|%s %u %lld", v->path.c_str(), v->face,
+                    ec_ ? 0ll : (long long)time_.time_since_epoch().count());
+                const FontCache::FaceSource source_ = FontCache::get().faceSource(v->id);
+                settings_ += v->name + setbuf_ + source_.instance;
+                for (auto& axis : source_.axis)
+                {
+                    std::snprintf(setbuf_, 512, " %c%c%c%c=%g", (char)(axis.first >> 24), (char)(axis.first >> 16),
+                        (char)(axis.first >> 8), (char)axis.first, axis.second);
+                    settings_ += setbuf_;
+                }
+                for (uint32_t px : v->size)
+                {
+                    settings_ += " " + std::to_string(px);
+                }
+                for (auto& fallback : v->fallback)
+                {
+                    settings_ += " >" + fallback;
+                }
+            }
+            std::scoped_lock lock_(incremental_lock_);
+            auto it = incremental_state_.find(state_key_);
+            if (it != incremental_state_.end() && it->second->settings == settings_
+                && it->second->code.size() == _fontlist.size())
+            {
+                previous_ = it->second;
+                for (size_t idx = 0; idx < _fontlist.size() && previous_; idx += 1)
+                {
+                    CodeSet kept_ = previous_->code[idx];
+                    kept_.intersect(_fontlist[idx]->code);
+                    if (kept_.size() != previous_->code[idx].size())
+                    {
+                        previous_ = nullptr;
+                    }
+                }
+            }
+        }
+        else
+        {
+            std::scoped_lock lock_(incremental_lock_);
+            incremental_state_.erase(state_key_);
+        }
         
         // get all glyph size all sort
-        struct GlyphInfo
-        {
-            // basic
-            uint32_t code;
-            uint32_t width;
-            uint32_t height;
-            uint32_t font;
-            // on texture
-            uint32_t texture;
-            uint32_t channel;
-            float uv_x;
-            float uv_y;
-            float uv_width;
-            float uv_height;
-            // on drawing
-            float draw_width;
-            float draw_height;
-            float h_pen_x;
-            float h_pen_y;
-            float h_advance;
-            float v_pen_x;
-            float v_pen_y;
-            float v_advance;
-        };
         std::vector<GlyphInfo> glyphlist_;
         for (uint32_t idx = 0; idx < _fontlist.size(); idx += 1)
         {
+            // resolve fallback chain, the font itself always comes first
+            TraceScope trace_font_("font", "measure %s", _fontlist[idx]->name.c_str());
+            std::vector<uint32_t> chain_;
+            chain_.push_back(idx);
+            for (auto& name : _fontlist[idx]->fallback)
+            {
+                auto it = std::find_if(_fontlist.begin(), _fontlist.end(),
+                    [&](const FontConfig* v) { return v->name == name; });
+                if (it != _fontlist.end())
+                {
+                    chain_.push_back((uint32_t)(it - _fontlist.begin()));
+                }
+                else
+                {
+                    logger::warn("font \"%s\": fallback font \"%s\" not found\n",
+                        _fontlist[idx]->name.c_str(), name.c_str());
+                }
+            }
+            std::vector<uint32_t> missing_;
+            uint32_t fallback_count_ = 0;
             for (uint32_t c : _fontlist[idx]->code)
             {
-                FT_UInt cidx = FT_Get_Char_Index(ft_.face[idx], c);
-                if (cidx > 0)
+                if (previous_ && previous_->code[idx].contains(c))
                 {
-                    fterr_ = FT_Load_Glyph(ft_.face[idx], cidx, FT_LOAD_DEFAULT);
-                    if (fterr_ == FT_Err_Ok)
+                    continue;
+                }
+                bool found_ = false;
+                for (uint32_t source : chain_)
+                {
+                    FT_UInt cidx = ft_->charIndex(_fontlist[source]->id, c);
+                    if (cidx > 0)
                     {
+                        found_ = true;
                         GlyphInfo info_ = {};
                         info_.code = c;
-                        info_.width = ft_.face[idx]->glyph->bitmap.width,
-                        info_.height = ft_.face[idx]->glyph->bitmap.rows,
                         info_.font = idx;
+                        info_.source = source;
+                        info_.index = cidx;
                         glyphlist_.push_back(info_);
+                        if (source != idx)
+                        {
+                            fallback_count_ += 1;
+                        }
+                        break;
                     }
                 }
-                else
+                if (!found_)
+                {
+                    missing_.push_back(c);
+                }
+            }
+            if (fallback_count_ > 0)
+            {
+                logger::info("font \"%s\": %u glyphs from fallback fonts\n",
+                    _fontlist[idx]->name.c_str(), fallback_count_);
+            }
+            _stats.glyphs_missing += (uint32_t)missing_.size();
+            if (!missing_.empty())
+            {
+                // one summary line per font instead of one line per code point
+                std::string list_;
+                char codebuf_[16] = {};
+                for (size_t i = 0; i < missing_.size() && i < 16; i += 1)
+                {
+                    std::snprintf(codebuf_, 16, " U+%04X", missing_[i]);
+                    list_ += codebuf_;
+                }
+                logger::warn("font \"%s\": %u glyphs not found:%s%s\n",
+                    _fontlist[idx]->name.c_str(), (uint32_t)missing_.size(), list_.c_str(),
+                    missing_.size() > 16 ? " ..." : "");
+            }
+        }
+        stage_end_(BuildStage::Measure);
+        progress_(0.05f);
+        if (cancelled_())
+        {
+            return false;
+        }
+        if (previous_ && glyphlist_.empty())
+        {
+            // nothing to add, the files of the previous build are up to date
+            auto state_ = std::make_shared<IncrementalState>(*previous_);
+            for (size_t idx = 0; idx < _fontlist.size(); idx += 1)
+            {
+                state_->code[idx] = _fontlist[idx]->code;
+            }
+            {
+                std::scoped_lock lock_(incremental_lock_);
+                incremental_state_[state_key_] = std::move(state_);
+            }
+            logger::info("no new glyphs, %s is up to date\n", state_key_.c_str());
+            _stats.process_peak_memory = processPeakMemory();
+            progress_(1.0f);
+            return true;
+        }
+        
+        // render all glyph, freetype face is not thread safe so only the post process runs in parallel
+        const bool distance_field_ = _imagemode != GlyphImageMode::Normal;
+        const uint32_t glyph_padding_ = distance_field_ ? std::max(glyph_edge, _spread) : glyph_edge;
+        std::vector<GlyphImage> imagelist_;
+        const StrokeMode stroke_mode_ = distance_field_ ? StrokeMode::None : _strokemode;
+        if (stroke_mode_ != _strokemode)
+        {
+            logger::warn("stroke is not available for distance field images, disabled\n");
+        }
+        const ShadowMode shadow_mode_ = distance_field_ ? ShadowMode::None : _shadowmode;
+        if (shadow_mode_ != _shadowmode)
+        {
+            logger::warn("shadow is not available for distance field images, disabled\n");
+        }
+        const bool combine_ = stroke_mode_ == StrokeMode::Channel || shadow_mode_ == ShadowMode::Channel;
+        FT_Stroker stroker_ = NULL;
+        if (stroke_mode_ != StrokeMode::None)
+        {
+            fterr_ = FT_Stroker_New(ft_->library(), &stroker_);
+            if (fterr_ != FT_Err_Ok)
+            {
+                return false;
+            }
+            const FT_Stroker_LineJoin join_[3] = {
+                FT_STROKER_LINEJOIN_ROUND,
+                FT_STROKER_LINEJOIN_BEVEL,
+                FT_STROKER_LINEJOIN_MITER,
+            };
+            FT_Stroker_Set(stroker_, (FT_Fixed)(_strokewidth * 64.0f), FT_STROKER_LINECAP_ROUND,
+                join_[(int)_strokejoin], 4 * 0x10000);
+        }
+        // all layers of one glyph before the effect stage
+        struct GlyphLayers
+        {
+            GlyphImage fill;
+            GlyphImage stroke;
+            GlyphImage shadow;
+            GlyphShape shape;
+            bool stroked = false;
+        };
+        // rasterize in chunks, a memory budget keeps only the bitmaps that fit resident,
+        // the rest is spilled to a temporary file and read back one by one while packing;
+        // a chunk ends once its layers would not fit next to the resident bitmaps
+        const uint64_t page_bytes_ = (uint64_t)texture_width * texture_height * sizeof(Color);
+        // the page being packed and the buffers of its encoder and mip levels
+        const uint64_t bitmap_budget_ = _memorybudget > 2 * page_bytes_ ? _memorybudget - 2 * page_bytes_ : 0;
+        if (_memorybudget > 0 && bitmap_budget_ == 0)
+        {
+            logger::warn("memory budget is below two pages of %ux%u, every glyph bitmap is spilled\n",
+                texture_width, texture_height);
+        }
+        const std::wstring spill_path_ = toWide(path) + L"\\glyphs.tmp";
+        std::fstream spill_file_;
+        bool spill_failed_ = false;
+        std::vector<uint64_t> spill_offset_; // by image, UINT64_MAX while resident
+        uint64_t resident_bytes_ = 0;
+        uint64_t peak_resident_ = 0;
+        bool io_ok_ = true; // every page and the index reached the disk
+        size_t spill_next_ = 0; // oldest image that may still be resident
+        auto spill_ = [&]()
+        {
+            for (; spill_next_ < imagelist_.size() && resident_bytes_ > bitmap_budget_; spill_next_ += 1)
+            {
+                if (!spill_file_.is_open())
+                {
+                    std::filesystem::create_directories(toWide(path));
+                    spill_file_.open(spill_path_, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+                    if (!spill_file_.is_open())
+                    {
+                        logger::warn("can not create the spill file, glyph bitmaps stay in memory\n");
+                        spill_failed_ = true;
+                        return;
+                    }
+                }
+                auto& pixels_ = imagelist_[spill_next_].pixels;
+                spill_file_.seekp((std::streamoff)_stats.bytes_spilled);
+                spill_file_.write((const char*)pixels_.data(), (std::streamsize)pixels_.size());
+                if (!spill_file_.good())
+                {
+                    // this bitmap and the following stay resident, the ones written so far are still read back
+                    logger::warn("can not write the spill file, glyph bitmaps stay in memory\n");
+                    spill_file_.clear();
+                    spill_failed_ = true;
+                    return;
+                }
+                spill_offset_.resize(imagelist_.size(), UINT64_MAX);
+                spill_offset_[spill_next_] = _stats.bytes_spilled;
+                _stats.bytes_spilled += pixels_.size();
+                resident_bytes_ -= pixels_.size();
+                pixels_ = std::vector<uint8_t>();
+            }
+        };
+        auto remove_spill_ = [&]()
+        {
+            if (spill_file_.is_open())
+            {
+                spill_file_.close();
+                std::error_code ec_;
+                std::filesystem::remove(spill_path_, ec_);
+            }
+        };
+        std::vector<GlyphInfo> sourcelist_ = std::move(glyphlist_);
+        glyphlist_.clear();
+        // bytes of the layers of one glyph once the effect stage is done, distance fields are rgba,
+        // shadows grow by the blur radius and combined layers take the rgba union rectangle
+        auto layers_bytes_ = [&](const GlyphLayers& layers) -> uint64_t
+        {
+            const uint64_t grow_ = shadow_mode_ != ShadowMode::None
+                ? 2 * (uint64_t)std::ceil(std::max(_shadowradius, 0.0f)) : 0;
+            const GlyphImage& caster_ = layers.stroked ? layers.stroke : layers.fill;
+            const uint64_t shadow_width_ = shadow_mode_ != ShadowMode::None ? caster_.width + grow_ : 0;
+            const uint64_t shadow_height_ = shadow_mode_ != ShadowMode::None ? caster_.height + grow_ : 0;
+            uint64_t bytes_ = (uint64_t)layers.fill.width * layers.fill.height * (_imagemode == GlyphImageMode::MSDF ? 4 : 1)
+                + layers.stroke.pixels.size() + shadow_width_ * shadow_height_
+                + layers.shape.points.size() * sizeof(GlyphShape::Point)
+                + layers.shape.edges.size() * sizeof(GlyphShape::Edge)
+                + layers.shape.contours.size() * sizeof(GlyphShape::Contour);
+            if (combine_)
+            {
+                const uint64_t width_ = std::max<uint64_t>(caster_.width, shadow_width_ + (uint64_t)std::abs(_shadowoffsetx));
+                const uint64_t height_ = std::max<uint64_t>(caster_.height, shadow_height_ + (uint64_t)std::abs(_shadowoffsety));
+                bytes_ += width_ * height_ * 4;
+            }
+            return bytes_;
+        };
+        // done in source glyphs, rendering is the first half of each chunk and effects the second
+        auto raster_progress_ = [&](double done)
+        {
+            progress_(0.05f + 0.55f * (float)(done / (double)std::max<size_t>(sourcelist_.size(), 1)));
+        };
+        size_t chunk_last_ = 0;
+        for (size_t chunk_first_ = 0; chunk_first_ < sourcelist_.size() && !_cancel.load(std::memory_order_relaxed);
+            chunk_first_ = chunk_last_)
+        {
+            chunk_last_ = chunk_first_;
+            const size_t image_first_ = imagelist_.size();
+            std::vector<GlyphInfo> chunklist_;
+            std::vector<GlyphLayers> layerlist_;
+            // without a budget, or once spilling failed, everything is one chunk
+            const uint64_t chunk_allowance_ = (_memorybudget == 0 || spill_failed_) ? UINT64_MAX
+                : (bitmap_budget_ > resident_bytes_ ? bitmap_budget_ - resident_bytes_ : 0);
+            uint64_t chunk_bytes_ = 0;
+            {
+                std::vector<GlyphInfo> rendered_;
+                if (chunk_allowance_ == UINT64_MAX)
+                {
+                    rendered_.reserve(sourcelist_.size() - chunk_first_);
+                    layerlist_.reserve(sourcelist_.size() - chunk_first_);
+                }
+                // fill, stroke and msdf shape from a loaded glyph slot or a scaled outline glyph,
+                // the outline glyph has no metrics so they are scaled from font units
+                auto render_ = [&](GlyphInfo v, FT_GlyphSlot slot, FT_Glyph outline,
+                    const FT_Glyph_Metrics& metrics, FT_Fixed scale)
+                {
+                    GlyphLayers layers_;
+                    if (_imagemode == GlyphImageMode::MSDF)
+                    {
+                        if (slot)
+                        {
+                            loadGlyphShape(slot, layers_.shape);
+                        }
+                        else
+                        {
+                            loadGlyphShape(&((FT_OutlineGlyph)outline)->outline, layers_.shape);
+                        }
+                    }
+                    FT_Glyph stroke_outline_ = NULL;
+                    if (stroke_mode_ != StrokeMode::None)
+                    {
+                        // keep the outline for the stroker
+                        if (slot)
+                        {
+                            FT_Get_Glyph(slot, &stroke_outline_);
+                        }
+                        else
+                        {
+                            FT_Glyph_Copy(outline, &stroke_outline_);
+                        }
+                    }
+                    bool filled_ = false;
+                    if (slot)
+                    {
+                        filled_ = FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL) == FT_Err_Ok
+                            && copyGlyphImage(slot, glyph_padding_, layers_.fill);
+                    }
+                    else
+                    {
+                        filled_ = renderGlyphOutline(ft_->library(), (FT_OutlineGlyph)outline, metrics, scale,
+                            glyph_padding_, layers_.fill);
+                    }
+                    if (!filled_)
+                    {
+                        if (stroke_outline_)
+                        {
+                            FT_Done_Glyph(stroke_outline_);
+                        }
+                        return;
+                    }
+                    layers_.stroked = stroke_outline_
+                        && renderGlyphStroke(stroke_outline_, stroker_, layers_.fill, layers_.stroke);
+                    v.layer = 0;
+                    v.image = (uint32_t)layerlist_.size();
+                    const uint64_t bytes_ = layers_bytes_(layers_);
+                    chunk_bytes_ += bytes_;
+                    resident_bytes_ += bytes_;
+                    peak_resident_ = std::max(peak_resident_, resident_bytes_);
+                    layerlist_.push_back(std::move(layers_));
+                    rendered_.push_back(v);
+                };
+                // batches only group the trace spans, rendering stays glyph by glyph
+                const size_t render_batch_ = 256;
+                bool chunk_full_ = false;
+                for (size_t first_ = chunk_first_; first_ < sourcelist_.size() && !chunk_full_
+                    && !_cancel.load(std::memory_order_relaxed); first_ += render_batch_)
+                {
+                    const size_t last_ = std::min(first_ + render_batch_, sourcelist_.size());
+                    TraceScope trace_batch_("raster", "render %zu-%zu", first_, last_ - 1);
+                    for (size_t i = first_; i < last_ && !chunk_full_; i += 1)
+                    {
+                        GlyphInfo v = sourcelist_[i];
+                        const uint32_t size_count_ = (uint32_t)_fontlist[v.font]->size.size();
+                        FT_Glyph unscaled_ = NULL;
+                        FT_Glyph_Metrics metrics_ = {};
+                        if (size_count_ > 1)
+                        {
+                            // load the outline once in font units, every size is a scaled copy
+                            FT_Face ftface_ = ft_->face(_fontlist[v.source]->id);
+                            if (ftface_
+                                && FT_Load_Glyph(ftface_, v.index, FT_LOAD_NO_SCALE) == FT_Err_Ok
+                                && ftface_->glyph->format == FT_GLYPH_FORMAT_OUTLINE
+                                && FT_Get_Glyph(ftface_->glyph, &unscaled_) == FT_Err_Ok)
+                            {
+                                metrics_ = ftface_->glyph->metrics;
+                            }
+                        }
+                        for (uint32_t k = 0; k < size_count_; k += 1)
+                        {
+                            v.size = k;
+                            const uint32_t px_ = pixel_size_(v.font, v.source, k);
+                            if (unscaled_)
+                            {
+                                FT_Face ftface_ = ft_->face(_fontlist[v.source]->id);
+                                const FT_Fixed scale_ = FT_DivFix((FT_Long)px_ * 64, ftface_->units_per_EM);
+                                FT_Glyph scaled_ = NULL;
+                                if (FT_Glyph_Copy(unscaled_, &scaled_) != FT_Err_Ok)
+                                {
+                                    continue;
+                                }
+                                FT_Matrix matrix_ = { scale_, 0, 0, scale_ };
+                                FT_Glyph_Transform(scaled_, &matrix_, NULL);
+                                render_(v, NULL, scaled_, metrics_, scale_);
+                                FT_Done_Glyph(scaled_);
+                            }
+                            else
+                            {
+                                FT_Face ftface_ = face_(v.source, px_);
+                                if (ftface_ == NULL || FT_Load_Glyph(ftface_, v.index, FT_LOAD_DEFAULT) != FT_Err_Ok)
+                                {
+                                    continue;
+                                }
+                                render_(v, ftface_->glyph, NULL, metrics_, 0);
+                            }
+                        }
+                        if (unscaled_)
+                        {
+                            FT_Done_Glyph(unscaled_);
+                        }
+                        // at least one source glyph per chunk, with all its sizes
+                        chunk_last_ = i + 1;
+                        chunk_full_ = chunk_bytes_ >= chunk_allowance_;
+                    }
+                    raster_progress_((double)chunk_first_ + 0.5 * (double)(chunk_last_ - chunk_first_));
+                }
+                chunklist_ = std::move(rendered_);
+            }
+            // effect stage, every glyph is independent, small batches keep the workers busy to the end
+            const size_t effect_batch_ = 16;
+            std::atomic<size_t> effect_done_{ 0 };
+            parallelFor((layerlist_.size() + effect_batch_ - 1) / effect_batch_, [&](size_t b)
+            {
+                if (_cancel.load(std::memory_order_relaxed))
+                {
+                    return;
+                }
+                const size_t first_ = b * effect_batch_;
+                const size_t last_ = std::min(first_ + effect_batch_, layerlist_.size());
+                TraceScope trace_batch_("raster", "effect %zu-%zu", chunk_first_ + first_, chunk_first_ + last_ - 1);
+                for (size_t i = first_; i < last_; i += 1)
+                {
+                    GlyphLayers& layers_ = layerlist_[i];
+                    switch (_imagemode)
+                    {
+                    case GlyphImageMode::SDF:
+                        makeSignedDistanceField(layers_.fill, _spread);
+                        break;
+                    case GlyphImageMode::MSDF:
+                        makeMultiChannelSignedDistanceField(layers_.fill, layers_.shape, _spread);
+                        layers_.shape = GlyphShape();
+                        break;
+                    default:
+                        break;
+                    }
+                    if (shadow_mode_ != ShadowMode::None)
+                    {
+                        // the shadow is cast by the outermost layer
+                        makeGlyphShadow(layers_.stroked ? layers_.stroke : layers_.fill,
+                            _shadowradius, _shadowoffsetx, _shadowoffsety, layers_.shadow);
+                    }
+                    if (combine_)
+                    {
+                        GlyphImage combined_;
+                        combineGlyphLayers(layers_.fill,
+                            (stroke_mode_ == StrokeMode::Channel && layers_.stroked) ? &layers_.stroke : nullptr,
+                            shadow_mode_ == ShadowMode::Channel ? &layers_.shadow : nullptr,
+                            combined_);
+                        layers_.fill = std::move(combined_);
+                    }
+                }
+                const size_t done_ = effect_done_.fetch_add(last_ - first_) + (last_ - first_);
+                raster_progress_((double)chunk_first_ + (double)(chunk_last_ - chunk_first_)
+                    * (0.5 + 0.5 * (double)done_ / (double)layerlist_.size()));
+            });
+            {
+                // layers which are not combined become glyph entries of their own
+                for (auto v : chunklist_)
                 {
-                    logger::warn("font \"%s\": glyph %u not found\n", _fontlist[idx]->name.c_str(), c);
+                    GlyphLayers& layers_ = layerlist_[v.image];
+                    v.image = (uint32_t)imagelist_.size();
+                    imagelist_.push_back(std::move(layers_.fill));
+                    glyphlist_.push_back(v);
+                    if (stroke_mode_ == StrokeMode::Separate && layers_.stroked)
+                    {
+                        v.layer = 1;
+                        v.image = (uint32_t)imagelist_.size();
+                        imagelist_.push_back(std::move(layers_.stroke));
+                        glyphlist_.push_back(v);
+                    }
+                    if (shadow_mode_ == ShadowMode::Separate)
+                    {
+                        v.layer = 2;
+                        v.image = (uint32_t)imagelist_.size();
+                        imagelist_.push_back(std::move(layers_.shadow));
+                        glyphlist_.push_back(v);
+                    }
                 }
+                layerlist_.clear();
             }
+            resident_bytes_ -= chunk_bytes_;
+            for (size_t i = image_first_; i < imagelist_.size(); i += 1)
+            {
+                resident_bytes_ += imagelist_[i].pixels.size();
+            }
+            peak_resident_ = std::max(peak_resident_, resident_bytes_);
+            if (_memorybudget > 0 && !spill_failed_)
+            {
+                spill_();
+            }
+        }
+        if (stroker_)
+        {
+            FT_Stroker_Done(stroker_);
+            stroker_ = NULL;
         }
+        if (cancelled_())
+        {
+            remove_spill_();
+            return false;
+        }
+        sourcelist_ = std::vector<GlyphInfo>();
+        for (auto& v : glyphlist_)
+        {
+            v.width = imagelist_[v.image].width;
+            v.height = imagelist_[v.image].height;
+        }
+        _stats.glyphs_rendered = (uint32_t)glyphlist_.size();
+        stage_end_(BuildStage::Raster);
+        
+        // multi channel packing needs single channel images
+        const bool multichannel_ = _multichannel
+            && _imagemode != GlyphImageMode::MSDF
+            && !combine_;
+        if (_multichannel && !multichannel_)
+        {
+            logger::warn("multi channel packing is not available for rgba glyph images, disabled\n");
+        }
+        
         struct GlyphInfoComparer
         {
             bool operator()(const GlyphInfo& a, const GlyphInfo& b) const
@@ -198,167 +972,338 @@ namespace fontatlas
                 {
                     return a.code < b.code;
                 }
-                else
+                else if (a.font != b.font)
                 {
                     return a.font < b.font;
                 }
+                else if (a.size != b.size)
+                {
+                    return a.size < b.size;
+                }
+                else
+                {
+                    return a.layer < b.layer;
+                }
             }
         };
         GlyphInfoComparer comparer_;
         std::sort(glyphlist_.begin(), glyphlist_.end(), comparer_);
+        stage_end_(BuildStage::Sort);
+        
+        // mipmap levels are limited by the page size, glyph cells are aligned to the last level
+        uint32_t miplevels_ = _miplevels;
+        while (miplevels_ > 0 && (std::min(texture_width, texture_height) >> miplevels_) == 0)
+        {
+            miplevels_ -= 1;
+        }
+        if (miplevels_ != _miplevels)
+        {
+            logger::warn("mipmap levels limited to %u by the texture size\n", miplevels_);
+        }
+        const uint32_t mipstep_ = 1u << miplevels_;
+        if (miplevels_ > 0 && (texture_width % mipstep_ != 0 || texture_height % mipstep_ != 0))
+        {
+            logger::warn("texture size is not a multiple of %u, the last mip level is not exact\n", mipstep_);
+        }
+        auto mipalign_ = [&](uint32_t v) { return (v + mipstep_ - 1) & ~(mipstep_ - 1); };
+        // at least one texel between glyphs on the last level
+        const uint32_t edge_ = miplevels_ > 0 ? mipalign_(std::max(texture_edge, mipstep_)) : texture_edge;
+        // white glyphs: transparent texels stay white so the mip levels have no dark fringe
+        const bool white_ = !multichannel_ && !combine_ && _imagemode != GlyphImageMode::MSDF;
+        const fontatlas::Color background_ = (miplevels_ > 0 && white_)
+            ? fontatlas::Color(255, 255, 255, 0) : fontatlas::Color(0, 0, 0, 0);
         
         // generate font atlas
         uint32_t total_texture_ = 0;
+        std::shared_ptr<IncrementalState> state_;
         {
             uint32_t image = 1;
             fontatlas::Texture tex(texture_width, texture_height);
-            uint32_t x = texture_edge;
-            uint32_t y = texture_edge;
+            tex.clear(background_);
+            uint32_t x = edge_;
+            uint32_t y = edge_;
             uint32_t down = 0;
             uint32_t channel = 0; // 0 r 1 g 2 b 3 a
             uint32_t image_glyphs = 0;
+            uint64_t image_texels = 0;
+            if (previous_)
+            {
+                // pages before the last one are not touched
+                image = previous_->image;
+                tex = previous_->page;
+                x = previous_->x;
+                y = previous_->y;
+                down = previous_->down;
+                channel = previous_->channel;
+                image_glyphs = previous_->page_glyphs;
+                image_texels = previous_->page_texels;
+            }
+            // pages and mip levels are written to a temporary file first, readers never see a partial image
+            auto save_texture_ = [&](Texture& texture, const char* file, ImageFileFormat format, uint32_t levels)
+            {
+                const std::string temp_ = std::string(file) + ".tmp";
+                if (!texture.save(temp_, format, levels) || !replaceFile(toWide(temp_), toWide(file)))
+                {
+                    logger::error("can not write %s\n", file);
+                    io_ok_ = false;
+                    return;
+                }
+                count_bytes_(file, format);
+            };
+            // blit and encode run inside the packing loop, packing gets the rest,
+            // blit is single threaded so its cpu time is its wall time
+            double blit_time_ = 0.0;
+            double encode_time_ = 0.0;
+            double encode_cpu_time_ = 0.0;
+            double page_trace_begin_ = tracer_.enabled() ? tracer_.now() : 0.0;
             auto save_image = [&]()
             {
+                const clock_::time_point encode_begin_ = clock_::now();
+                const double encode_cpu_begin_ = processCpuTime();
                 char buffer_[256] = {};
                 switch(_fileformat)
                 {
                 case ImageFileFormat::BMP:
                     snprintf(buffer_, 256, "%s%u.bmp", path.data(), image);
-                    tex.save(buffer_, ImageFileFormat::BMP);
+                    save_texture_(tex, buffer_, ImageFileFormat::BMP, 0);
                     logger::info("%u.bmp: %u glyphs\n", image, image_glyphs);
                     break;
+                case ImageFileFormat::DDS:
+                    snprintf(buffer_, 256, "%s%u.dds", path.data(), image);
+                    save_texture_(tex, buffer_, ImageFileFormat::DDS, miplevels_);
+                    logger::info("%u.dds: %u glyphs\n", image, image_glyphs);
+                    break;
                 case ImageFileFormat::PNG:
                 default:
                     snprintf(buffer_, 256, "%s%u.png", path.data(), image);
-                    tex.save(buffer_, ImageFileFormat::PNG);
+                    save_texture_(tex, buffer_, ImageFileFormat::PNG, 0);
                     logger::info("%u.png: %u glyphs\n", image, image_glyphs);
                     break;
                 }
-                tex.clear();
+                if (_fileformat != ImageFileFormat::DDS && miplevels_ > 0)
+                {
+                    // other formats have no mip chain, write each level as another file
+                    const char* ext_ = _fileformat == ImageFileFormat::BMP ? "bmp" : "png";
+                    fontatlas::Texture mip_ = tex.downsample();
+                    for (uint32_t level = 1; level <= miplevels_; level += 1)
+                    {
+                        snprintf(buffer_, 256, "%s%u_mip%u.%s", path.data(), image, level, ext_);
+                        save_texture_(mip_, buffer_, _fileformat, 0);
+                        if (level < miplevels_)
+                        {
+                            mip_ = mip_.downsample();
+                        }
+                    }
+                }
+                const uint64_t capacity_ = (uint64_t)texture_width * texture_height * (multichannel_ ? 4 : 1);
+                _stats.page.push_back(BuildStats::Page{ image_glyphs, image_texels, (double)image_texels / (double)capacity_ });
+                tex.clear(background_);
                 image += 1;
                 image_glyphs = 0;
+                image_texels = 0;
+                encode_time_ += seconds_(encode_begin_, clock_::now());
+                encode_cpu_time_ += processCpuTime() - encode_cpu_begin_;
+                if (tracer_.enabled())
+                {
+                    // packing, blit and encode of one page
+                    const double trace_now_ = tracer_.now();
+                    char name_[32] = {};
+                    std::snprintf(name_, 32, "page %u", image - 1);
+                    tracer_.complete("page", name_, page_trace_begin_, trace_now_);
+                    page_trace_begin_ = trace_now_;
+                }
             };
-            auto upload_bitmap = [&](GlyphInfo& info, FT_GlyphSlot& glyph, FT_Bitmap& bitmap)
+            auto upload_image = [&](GlyphInfo& info, GlyphImage& glyph)
             {
-                if (bitmap.num_grays == 256)
+                // real glyph size, padding included
+                uint32_t glyphx = glyph.width;
+                uint32_t glyphy = glyph.height;
+                // cell on the texture, aligned so no mip texel is shared by two glyphs
+                const uint32_t cellx = mipalign_(glyphx);
+                const uint32_t celly = mipalign_(glyphy);
+                // check horizontal space
+                if ((x + cellx) > (texture_width - edge_))
+                {
+                    // next line
+                    x = edge_;
+                    y += (down + edge_);
+                    down = 0;
+                }
+                // check vertical space
+                if ((y + celly) > (texture_height - edge_))
                 {
-                    // real glyph size
-                    uint32_t glyphx = bitmap.width + 2 * glyph_edge;
-                    uint32_t glyphy = bitmap.rows  + 2 * glyph_edge;
-                    // check horizontal space
-                    if ((x + glyphx) > (texture_width - texture_edge))
+                    if (!multichannel_)
                     {
-                        // next line
-                        x = texture_edge;
-                        y += (down + texture_edge);
-                        down = 0;
+                        
+                        // next image
+                        save_image();
                     }
-                    // check vertical space
-                    if ((y + glyphy) > (texture_height - texture_edge))
+                    else
                     {
-                        if (!_multichannel)
+                        if (channel >= 3)
                         {
-                            
                             // next image
                             save_image();
+                            channel = 0;
                         }
                         else
                         {
-                            if (channel >= 3)
-                            {
-                                // next image
-                                save_image();
-                                channel = 0;
-                            }
-                            else
-                            {
-                                // next channel
-                                channel += 1;
-                            }
+                            // next channel
+                            channel += 1;
                         }
-                        // reset
-                        x = texture_edge;
-                        y = texture_edge;
-                        down = 0;
                     }
-                    // copy pixel data
-                    uint8_t* buffer = bitmap.buffer;
-                    uint32_t startx = x + glyph_edge;
-                    uint32_t starty = y + glyph_edge;
-                    uint32_t endx = startx + bitmap.width;
-                    uint32_t endy = starty + bitmap.rows;
-                    for (uint32_t peny = starty; peny < endy; peny += 1)
+                    // reset
+                    x = edge_;
+                    y = edge_;
+                    down = 0;
+                }
+                // copy pixel data
+                const clock_::time_point blit_begin_ = clock_::now();
+                for (uint32_t peny = 0; peny < glyphy; peny += 1)
+                {
+                    const uint8_t* buffer = glyph.row(peny);
+                    for (uint32_t penx = 0; penx < glyphx; penx += 1)
                     {
-                        uint32_t index = 0;
-                        for (uint32_t penx = startx; penx < endx; penx += 1)
+                        fontatlas::Color& px = tex.pixel(x + penx, y + peny);
+                        if (glyph.channels == 4)
                         {
-                            if (!_multichannel)
-                            {
-                                tex.pixel(penx, peny) = fontatlas::Color(255, 255, 255, buffer[index]);
-                            }
-                            else
+                            px = fontatlas::Color(buffer[0], buffer[1], buffer[2], buffer[3]);
+                        }
+                        else if (!multichannel_)
+                        {
+                            px = fontatlas::Color(255, 255, 255, buffer[0]);
+                        }
+                        else
+                        {
+                            switch(channel)
                             {
-                                switch(channel)
-                                {
-                                case 0:
-                                    tex.pixel(penx, peny).r = buffer[index];
-                                    break;
-                                case 1:
-                                    tex.pixel(penx, peny).g = buffer[index];
-                                    break;
-                                case 2:
-                                    tex.pixel(penx, peny).b = buffer[index];
-                                    break;
-                                case 3:
-                                default:
-                                    tex.pixel(penx, peny).a = buffer[index];
-                                    break;
-                                }
-                                //tex.pixel(penx, peny).a = 255; // debug
+                            case 0:
+                                px.r = buffer[0];
+                                break;
+                            case 1:
+                                px.g = buffer[0];
+                                break;
+                            case 2:
+                                px.b = buffer[0];
+                                break;
+                            case 3:
+                            default:
+                                px.a = buffer[0];
+                                break;
                             }
-                            index += 1;
+                            //px.a = 255; // debug
                         }
-                        buffer += bitmap.pitch;
+                        buffer += glyph.channels;
                     }
-                    // save data
-                    info.texture = image;
-                    info.channel = channel;
-                    info.uv_x = (float)x;
-                    info.uv_y = (float)y;
-                    info.uv_width  = (float)glyphx;
-                    info.uv_height = (float)glyphy;
-                    const float offset_xy = (float)glyph_edge;
-                    info.draw_width  = (float)glyph->metrics.width  / 64.0f + 2.0f * offset_xy;
-                    info.draw_height = (float)glyph->metrics.height / 64.0f + 2.0f * offset_xy;
-                    info.h_pen_x = (float)glyph->metrics.horiBearingX / 64.0f - offset_xy;
-                    info.h_pen_y = (float)glyph->metrics.horiBearingY / 64.0f + offset_xy;
-                    info.h_advance = (float)glyph->metrics.horiAdvance / 64.0f;
-                    info.v_pen_x = (float)glyph->metrics.vertBearingX / 64.0f - offset_xy;
-                    info.v_pen_y = (float)glyph->metrics.vertBearingY / 64.0f + offset_xy;
-                    info.v_advance = (float)glyph->metrics.vertAdvance / 64.0f;
-                    // move to right
-                    x += (glyphx + texture_edge);
-                    down = std::max(down, glyphy);
                 }
+                blit_time_ += seconds_(blit_begin_, clock_::now());
+                image_texels += (uint64_t)glyphx * glyphy;
+                // save data
+                info.texture = image;
+                info.channel = channel;
+                info.uv_x = (float)x;
+                info.uv_y = (float)y;
+                info.uv_width  = (float)glyphx;
+                info.uv_height = (float)glyphy;
+                const float offset_xy = (float)glyph.padding;
+                info.draw_width  = glyph.metrics_width  + 2.0f * offset_xy;
+                info.draw_height = glyph.metrics_height + 2.0f * offset_xy;
+                info.h_pen_x = glyph.h_bearing_x - offset_xy;
+                info.h_pen_y = glyph.h_bearing_y + offset_xy;
+                info.h_advance = glyph.h_advance;
+                info.v_pen_x = glyph.v_bearing_x - offset_xy;
+                info.v_pen_y = glyph.v_bearing_y + offset_xy;
+                info.v_advance = glyph.v_advance;
+                // move to right
+                x += (cellx + edge_);
+                down = std::max(down, celly);
             };
+            bool spill_read_failed_ = false;
             auto all_glyph = [&]()
             {
-                for (auto& v : glyphlist_)
+                for (size_t i = 0; i < glyphlist_.size(); i += 1)
                 {
-                    FT_UInt cidx = FT_Get_Char_Index(ft_.face[v.font], v.code);
-                    fterr_ = FT_Load_Glyph(ft_.face[v.font], cidx, FT_LOAD_DEFAULT | FT_LOAD_RENDER);
-                    assert(fterr_ == FT_Err_Ok);
-                    if (fterr_ == FT_Err_Ok)
+                    if (_cancel.load(std::memory_order_relaxed))
+                    {
+                        return;
+                    }
+                    GlyphInfo& v = glyphlist_[i];
+                    GlyphImage& glyph_ = imagelist_[v.image];
+                    if (v.image < spill_offset_.size() && spill_offset_[v.image] != UINT64_MAX)
+                    {
+                        glyph_.pixels.resize((size_t)glyph_.width * glyph_.height * glyph_.channels);
+                        spill_file_.seekg((std::streamoff)spill_offset_[v.image]);
+                        spill_file_.read((char*)glyph_.pixels.data(), (std::streamsize)glyph_.pixels.size());
+                        if (!spill_file_.good() || spill_file_.gcount() != (std::streamsize)glyph_.pixels.size())
+                        {
+                            logger::error("can not read U+%04X back from the spill file\n", v.code);
+                            spill_read_failed_ = true;
+                            return;
+                        }
+                    }
+                    upload_image(v, glyph_);
+                    if (_memorybudget > 0)
                     {
-                        upload_bitmap(v, ft_.face[v.font]->glyph, ft_.face[v.font]->glyph->bitmap);
-                        image_glyphs += 1;
+                        // packed glyphs are not needed again
+                        glyph_.pixels = std::vector<uint8_t>();
                     }
+                    image_glyphs += 1;
+                    progress_(0.60f + 0.35f * (float)(i + 1) / (float)glyphlist_.size());
                 }
             };
             std::filesystem::create_directories(toWide(path));
             all_glyph();
+            if (spill_read_failed_)
+            {
+                remove_spill_();
+                return false;
+            }
+            if (cancelled_())
+            {
+                // pages saved so far stay, index.lua is not written
+                remove_spill_();
+                return false;
+            }
+            if (_incremental)
+            {
+                // the last page stays open for the next incremental build
+                state_ = std::make_shared<IncrementalState>();
+                state_->page = tex;
+                state_->image = image;
+                state_->x = x;
+                state_->y = y;
+                state_->down = down;
+                state_->channel = channel;
+                state_->page_glyphs = image_glyphs;
+                state_->page_texels = image_texels;
+            }
             save_image();
+            remove_spill_();
             total_texture_ = image - 1;
+            stage_end_(BuildStage::Pack);
+            _stats.wall_time[(size_t)BuildStage::Pack] -= blit_time_ + encode_time_;
+            _stats.wall_time[(size_t)BuildStage::Blit] = blit_time_;
+            _stats.wall_time[(size_t)BuildStage::Encode] = encode_time_;
+            _stats.cpu_time[(size_t)BuildStage::Pack] = std::max(_stats.cpu_time[(size_t)BuildStage::Pack] - blit_time_ - encode_cpu_time_, 0.0);
+            _stats.cpu_time[(size_t)BuildStage::Blit] = blit_time_;
+            _stats.cpu_time[(size_t)BuildStage::Encode] = encode_cpu_time_;
+        }
+        {
+            uint64_t used_ = 0;
+            uint64_t capacity_ = 0;
+            for (auto& v : _stats.page)
+            {
+                used_ += v.used_texels;
+                capacity_ += (uint64_t)texture_width * texture_height * (multichannel_ ? 4 : 1);
+            }
+            _stats.pages = (uint32_t)_stats.page.size();
+            _stats.fill = capacity_ > 0 ? (double)used_ / (double)capacity_ : 0.0;
+            _stats.wasted_texels = capacity_ - used_;
+        }
+        imagelist_.clear();
+        if (previous_)
+        {
+            glyphlist_.insert(glyphlist_.begin(), previous_->glyph.begin(), previous_->glyph.end());
         }
         
         // get all glyph info all sort
@@ -371,6 +1316,14 @@ namespace fontatlas
         {
             bool operator()(const GlyphInfo* a, const GlyphInfo* b) const
             {   
+                if (a->size != b->size)
+                {
+                    return a->size < b->size;
+                }
+                if (a->layer != b->layer)
+                {
+                    return a->layer < b->layer;
+                }
                 return a->code < b->code;
             }
         };
@@ -380,81 +1333,280 @@ namespace fontatlas
             std::sort(v.begin(), v.end(), pcomparer_);
         }
         
+        // kerning pairs between glyphs rendered from the same face, in font units
+        struct KerningInfo
+        {
+            uint32_t first;  // code point
+            uint32_t second; // code point
+            uint32_t source;
+            int32_t value;
+        };
+        std::vector<std::vector<KerningInfo>> kerninglist_(_fontlist.size());
+        if (_kerning)
+        {
+            for (uint32_t idx = 0; idx < fontlist_.size(); idx += 1)
+            {
+                TraceScope trace_font_("font", "kerning %s", _fontlist[idx]->name.c_str());
+                // glyph index and code of every glyph, grouped by source font
+                std::unordered_map<uint32_t, std::vector<std::pair<uint32_t, uint32_t>>> source_;
+                for (auto* v : fontlist_[idx])
+                {
+                    if (v->layer == 0 && v->size == 0)
+                    {
+                        source_[v->source].emplace_back(v->index, v->code);
+                    }
+                }
+                auto& list_ = kerninglist_[idx];
+                for (auto& it : source_)
+                {
+                    auto& glyph_code_ = it.second;
+                    std::sort(glyph_code_.begin(), glyph_code_.end());
+                    std::vector<uint32_t> glyphs_;
+                    for (auto& v : glyph_code_)
+                    {
+                        if (glyphs_.empty() || glyphs_.back() != v.first)
+                        {
+                            glyphs_.push_back(v.first);
+                        }
+                    }
+                    std::vector<KerningPair> pairs_;
+                    loadKerningPairs(ft_->face(_fontlist[it.first]->id), glyphs_, pairs_);
+                    // several codes may share one glyph
+                    auto codes_ = [&](uint32_t glyph)
+                    {
+                        auto lo = std::lower_bound(glyph_code_.begin(), glyph_code_.end(), std::make_pair(glyph, 0u));
+                        auto hi = std::upper_bound(glyph_code_.begin(), glyph_code_.end(), std::make_pair(glyph, UINT32_MAX));
+                        return std::make_pair(lo, hi);
+                    };
+                    for (auto& v : pairs_)
+                    {
+                        auto first_ = codes_(v.first);
+                        auto second_ = codes_(v.second);
+                        for (auto a = first_.first; a != first_.second; ++a)
+                        {
+                            for (auto b = second_.first; b != second_.second; ++b)
+                            {
+                                list_.push_back(KerningInfo{ a->second, b->second, it.first, v.value });
+                            }
+                        }
+                    }
+                }
+                std::sort(list_.begin(), list_.end(), [](const KerningInfo& a, const KerningInfo& b)
+                {
+                    return a.first != b.first ? a.first < b.first : a.second < b.second;
+                });
+                logger::info("font \"%s\": %u kerning pairs\n", _fontlist[idx]->name.c_str(), (uint32_t)list_.size());
+            }
+        }
+        
         // generate index file
         {
+            const char* image_mode_name_[3] = { "normal", "sdf", "msdf" };
+            const char* stroke_mode_name_[3] = { "none", "channel", "separate" };
+            const char* shadow_mode_name_[3] = { "none", "channel", "separate" };
+            const char* layer_name_[3] = { "", "stroke", "shadow" };
+            const char* image_format_name_[3] = { "bmp", "png", "dds" };
             char fmtbuf_[1024] = {};
             std::wstring wpath_ = toWide(path) + L"\\index.lua";
-            std::ofstream file_(wpath_, std::ios::binary |std::ios::out | std::ios::trunc);
-            if (file_.is_open())
+            const std::wstring temp_path_ = wpath_ + L".tmp";
+            std::ofstream file_(temp_path_, std::ios::binary |std::ios::out | std::ios::trunc);
+            if (!file_.is_open())
+            {
+                logger::error("can not write %s\n", toUTF8(temp_path_).c_str());
+                io_ok_ = false;
+            }
+            else
             {
                 file_.write("local font = {}\n", 16);
                 {
                     int n = std::snprintf(fmtbuf_, 1024,
-                        "font.textures=%u\n",
-                        total_texture_);
+                        "font.textures=%u\n"
+                        "font.texture_size={%u,%u}\n"
+                        "font.mip_levels=%u\n"
+                        "font.image_format=\"%s\"\n",
+                        total_texture_, texture_width, texture_height, miplevels_, image_format_name_[(int)_fileformat]);
                     file_.write(fmtbuf_, n);
                 }
                 for (uint32_t idx = 0; idx < fontlist_.size(); idx += 1)
                 {
+                    TraceScope trace_font_("font", "index %s", _fontlist[idx]->name.c_str());
                     file_.write("font[\"", 6);
                     file_.write(_fontlist[idx]->name.data(), _fontlist[idx]->name.size());
                     file_.write("\"] = {\n", 7);
                     {
                         int n = std::snprintf(fmtbuf_, 1024,
                             "  multi_channel=%s,\n"
-                            "  ascender=%g,\n"
-                            "  descender=%g,\n"
-                            "  height=%g,\n"
-                            "  max_advance=%g,\n",
-                            _multichannel ? "true" : "false",
-                            (float)ft_.face[idx]->size->metrics.ascender / 64.0f,
-                            (float)ft_.face[idx]->size->metrics.descender / 64.0f,
-                            (float)ft_.face[idx]->size->metrics.height / 64.0f,
-                            (float)ft_.face[idx]->size->metrics.max_advance / 64.0f);
+                            "  image_mode=\"%s\",\n"
+                            "  spread=%u,\n"
+                            "  stroke_mode=\"%s\",\n"
+                            "  stroke_width=%g,\n"
+                            "  shadow_mode=\"%s\",\n"
+                            "  shadow_radius=%g,\n"
+                            "  shadow_offset={%d,%d},\n",
+                            multichannel_ ? "true" : "false",
+                            image_mode_name_[(int)_imagemode],
+                            distance_field_ ? _spread : 0u,
+                            stroke_mode_name_[(int)stroke_mode_],
+                            stroke_mode_ != StrokeMode::None ? _strokewidth : 0.0f,
+                            shadow_mode_name_[(int)shadow_mode_],
+                            shadow_mode_ != ShadowMode::None ? _shadowradius : 0.0f,
+                            shadow_mode_ != ShadowMode::None ? _shadowoffsetx : 0,
+                            shadow_mode_ != ShadowMode::None ? _shadowoffsety : 0);
                         file_.write(fmtbuf_, n);
                     }
-                    for (uint32_t i = 0; i < fontlist_[idx].size(); i += 1)
+                    // face metrics and glyphs of one size, glyphs are sorted by size first
+                    auto write_size_ = [&](uint32_t k, const std::string& indent, size_t& i)
                     {
-                        auto& v = *fontlist_[idx][i];
-                        if (!_multichannel)
                         {
+                            FT_Face ftface_ = face_(idx, _fontlist[idx]->size[k]);
                             int n = std::snprintf(fmtbuf_, 1024,
-                                "  [%u]={"
-                                "%u,3,%g,%g,%g,%g"
-                                ",%g,%g"
-                                ",%g,%g,%g"
-                                ",%g,%g,%g"
-                                "},\n",
-                                v.code,
-                                v.texture, v.uv_x, v.uv_y, v.uv_width, v.uv_height,
-                                v.draw_width, v.draw_height,
-                                v.h_pen_x, v.h_pen_y, v.h_advance,
-                                v.v_pen_x, v.v_pen_y, v.v_advance);
+                                "%s  ascender=%g,\n"
+                                "%s  descender=%g,\n"
+                                "%s  height=%g,\n"
+                                "%s  max_advance=%g,\n",
+                                indent.c_str(), (float)ftface_->size->metrics.ascender / 64.0f,
+                                indent.c_str(), (float)ftface_->size->metrics.descender / 64.0f,
+                                indent.c_str(), (float)ftface_->size->metrics.height / 64.0f,
+                                indent.c_str(), (float)ftface_->size->metrics.max_advance / 64.0f);
                             file_.write(fmtbuf_, n);
                         }
-                        else
+                        uint32_t layer_ = 0;
+                        for (; i < fontlist_[idx].size() && fontlist_[idx][i]->size == k; i += 1)
                         {
-                            int n = std::snprintf(fmtbuf_, 1024,
-                                "  [%u]={"
-                                "%u,%u,%g,%g,%g,%g"
-                                ",%g,%g"
-                                ",%g,%g,%g"
-                                ",%g,%g,%g"
-                                "},\n",
-                                v.code,
-                                v.texture, v.channel, v.uv_x, v.uv_y, v.uv_width, v.uv_height,
-                                v.draw_width, v.draw_height,
-                                v.h_pen_x, v.h_pen_y, v.h_advance,
-                                v.v_pen_x, v.v_pen_y, v.v_advance);
+                            auto& v = *fontlist_[idx][i];
+                            if (v.layer != layer_)
+                            {
+                                // stroke and shadow glyphs are written to sub tables
+                                if (layer_ != 0)
+                                {
+                                    file_.write(indent.data(), indent.size());
+                                    file_.write("  },\n", 5);
+                                }
+                                layer_ = v.layer;
+                                file_.write(indent.data(), indent.size());
+                                file_.write("  ", 2);
+                                file_.write(layer_name_[layer_], std::strlen(layer_name_[layer_]));
+                                file_.write("={\n", 3);
+                            }
+                            const char* indent_ = layer_ == 0 ? "" : "  ";
+                            if (!multichannel_)
+                            {
+                                int n = std::snprintf(fmtbuf_, 1024,
+                                    "%s%s  [%u]={"
+                                    "%u,3,%g,%g,%g,%g"
+                                    ",%g,%g"
+                                    ",%g,%g,%g"
+                                    ",%g,%g,%g"
+                                    "},\n",
+                                    indent.c_str(), indent_, v.code,
+                                    v.texture, v.uv_x, v.uv_y, v.uv_width, v.uv_height,
+                                    v.draw_width, v.draw_height,
+                                    v.h_pen_x, v.h_pen_y, v.h_advance,
+                                    v.v_pen_x, v.v_pen_y, v.v_advance);
+                                file_.write(fmtbuf_, n);
+                            }
+                            else
+                            {
+                                int n = std::snprintf(fmtbuf_, 1024,
+                                    "%s%s  [%u]={"
+                                    "%u,%u,%g,%g,%g,%g"
+                                    ",%g,%g"
+                                    ",%g,%g,%g"
+                                    ",%g,%g,%g"
+                                    "},\n",
+                                    indent.c_str(), indent_, v.code,
+                                    v.texture, v.channel, v.uv_x, v.uv_y, v.uv_width, v.uv_height,
+                                    v.draw_width, v.draw_height,
+                                    v.h_pen_x, v.h_pen_y, v.h_advance,
+                                    v.v_pen_x, v.v_pen_y, v.v_advance);
+                                file_.write(fmtbuf_, n);
+                            }
+                        }
+                        if (layer_ != 0)
+                        {
+                            file_.write(indent.data(), indent.size());
+                            file_.write("  },\n", 5);
+                        }
+                        // kerning={first,second,advance, ...}, sorted by first then second code
+                        if (!kerninglist_[idx].empty())
+                        {
+                            file_.write(indent.data(), indent.size());
+                            file_.write("  kerning={\n", 12);
+                            for (auto& v : kerninglist_[idx])
+                            {
+                                const float scale_ = (float)pixel_size_(idx, v.source, k)
+                                    / (float)ft_->face(_fontlist[v.source]->id)->units_per_EM;
+                                int n = std::snprintf(fmtbuf_, 1024,
+                                    "%s    %u,%u,%g,\n",
+                                    indent.c_str(), v.first, v.second, (float)v.value * scale_);
+                                file_.write(fmtbuf_, n);
+                            }
+                            file_.write(indent.data(), indent.size());
+                            file_.write("  },\n", 5);
+                        }
+                    };
+                    size_t i = 0;
+                    if (_fontlist[idx]->size.size() == 1)
+                    {
+                        write_size_(0, "", i);
+                    }
+                    else
+                    {
+                        // grouped per size: sizes={...}, size={[px]={...}}
+                        file_.write("  sizes={", 9);
+                        for (uint32_t k = 0; k < _fontlist[idx]->size.size(); k += 1)
+                        {
+                            int n = std::snprintf(fmtbuf_, 1024, "%u,", _fontlist[idx]->size[k]);
+                            file_.write(fmtbuf_, n);
+                        }
+                        file_.write("},\n", 3);
+                        file_.write("  size={\n", 9);
+                        for (uint32_t k = 0; k < _fontlist[idx]->size.size(); k += 1)
+                        {
+                            int n = std::snprintf(fmtbuf_, 1024, "    [%u]={\n", _fontlist[idx]->size[k]);
                             file_.write(fmtbuf_, n);
+                            write_size_(k, "    ", i);
+                            file_.write("    },\n", 7);
                         }
+                        file_.write("  },\n", 5);
                     }
                     file_.write("}\n", 2);
                 }
                 file_.write("return font\n", 12);
+                _stats.bytes_index = (uint64_t)file_.tellp();
                 file_.close();
+                // the index is replaced last, once it changes every page it refers to is complete
+                if (!file_.good() || !replaceFile(temp_path_, wpath_))
+                {
+                    logger::error("can not write %s\n", toUTF8(wpath_).c_str());
+                    io_ok_ = false;
+                }
+            }
+        }
+        stage_end_(BuildStage::Index);
+        if (!io_ok_)
+        {
+            // the files on disk do not match any state, the next incremental build starts over
+            std::scoped_lock lock_(incremental_lock_);
+            incremental_state_.erase(state_key_);
+            _stats.peak_memory = peak_resident_ + page_bytes_;
+            _stats.process_peak_memory = processPeakMemory();
+            return false;
+        }
+        if (state_)
+        {
+            state_->settings = std::move(settings_);
+            for (auto* v : _fontlist)
+            {
+                state_->code.push_back(v->code);
             }
+            state_->glyph = glyphlist_;
+            std::scoped_lock lock_(incremental_lock_);
+            incremental_state_[state_key_] = std::move(state_);
         }
+        _stats.peak_memory = peak_resident_ + page_bytes_;
+        _stats.process_peak_memory = processPeakMemory();
+        progress_(1.0f);
         
         return true;
     }
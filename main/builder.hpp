@@ -1,13 +1,93 @@
 #pragma once
 #include "texture.hpp"
+#include "codeset.hpp"
 #include <string>
 #include <string_view>
-#include <set>
 #include <vector>
+#include <functional>
 #include <unordered_map>
+#include <utility>
+#include <atomic>
 
 namespace fontatlas
 {
+    enum class GlyphImageMode
+    {
+        Normal, // coverage
+        SDF,    // signed distance field
+        MSDF,   // multi-channel signed distance field, stored in rgb
+    };
+    
+    enum class StrokeMode
+    {
+        None,
+        Channel,  // one rgba rectangle: r fill, g stroke, a stroke
+        Separate, // stroke is written as another glyph entry
+    };
+    
+    enum class ShadowMode
+    {
+        None,
+        Channel,  // blue channel of the rgba rectangle, alpha covers all layers
+        Separate, // shadow is written as another glyph entry
+    };
+    
+    enum class StrokeJoin
+    {
+        Round,
+        Bevel,
+        Miter,
+    };
+    
+    // stages of Builder::build, in the order they run
+    enum class BuildStage
+    {
+        Face,    // open faces and set sizes
+        Measure, // resolve code points and fallbacks to glyphs
+        Raster,  // render, stroke, distance field and shadow
+        Sort,
+        Pack,    // place glyphs on pages
+        Blit,    // copy glyph pixels to pages
+        Encode,  // save page images
+        Index,   // kerning and index.lua
+        Count,
+    };
+    
+    // result of the last Builder::build
+    struct BuildStats
+    {
+        struct Page
+        {
+            uint32_t glyphs; // glyph images, layers and sizes count separately
+            uint64_t used_texels; // glyph rectangles, padding included, every channel counts in multichannel mode
+            double fill; // used_texels by the texels of the page (times 4 in multichannel mode)
+        };
+        uint32_t glyphs_rendered = 0;
+        uint32_t glyphs_missing = 0; // code points not found in the font or its fallbacks
+        uint32_t pages = 0;
+        std::vector<Page> page;
+        double fill = 0.0; // over all pages
+        uint64_t wasted_texels = 0;
+        uint64_t bytes_bmp = 0; // mip level files included
+        uint64_t bytes_png = 0;
+        uint64_t bytes_dds = 0;
+        uint64_t bytes_index = 0;
+        uint64_t bytes_spilled = 0; // glyph bitmaps written to the temporary file of the memory budget
+        uint64_t peak_memory = 0; // bytes of this build: the page being packed and the peak of resident glyph bitmaps
+        size_t process_peak_memory = 0; // peak working set over the life of the process, earlier and concurrent builds included
+        double wall_time[(size_t)BuildStage::Count] = {}; // seconds
+        double cpu_time[(size_t)BuildStage::Count] = {}; // seconds of user and kernel time of the process, concurrent builds included
+    };
+    
+    // instance of a variable font
+    struct FontVariation
+    {
+        std::string instance; // named instance by style name, like "Bold"
+        std::vector<std::pair<std::string, float>> axis; // design coordinates by axis tag, like { "wght", 700.0f }
+    };
+    
+    // one instance is used by one thread at a time, separate instances may build concurrently on any threads
+    // as long as they write to different paths, each build leases its own freetype context
     class Builder
     {
     public:
@@ -16,23 +96,65 @@ namespace fontatlas
             std::string name;
             std::string path;
             uint32_t face;
-            uint32_t size;
-            std::set<uint32_t> code;
+            std::vector<uint32_t> size; // pixel sizes, more than one shares the outline load
+            uint32_t id; // FontCache face id, the variable font instance is part of its FaceSource
+            CodeSet code;
+            std::vector<std::string> fallback; // font names, tried in order for missing glyphs
         };
     private:
+        // lookup by string_view without a temporary std::string
+        struct NameHash
+        {
+            using is_transparent = void;
+            size_t operator()(const std::string_view v) const noexcept { return std::hash<std::string_view>()(v); }
+        };
         std::vector<FontConfig*> _fontlist;
-        std::unordered_map<std::string, FontConfig> _font;
+        std::unordered_map<std::string, FontConfig, NameHash, std::equal_to<>> _font;
         ImageFileFormat _fileformat = ImageFileFormat::PNG;
         bool _multichannel = false;
+        uint32_t _miplevels = 0;
+        bool _kerning = false;
+        GlyphImageMode _imagemode = GlyphImageMode::Normal;
+        uint32_t _spread = 4;
+        StrokeMode _strokemode = StrokeMode::None;
+        float _strokewidth = 1.0f;
+        StrokeJoin _strokejoin = StrokeJoin::Round;
+        ShadowMode _shadowmode = ShadowMode::None;
+        float _shadowradius = 2.0f;
+        int32_t _shadowoffsetx = 1;
+        int32_t _shadowoffsety = 1;
+        uint64_t _memorybudget = 0;
+        bool _incremental = false;
+        BuildStats _stats;
+        std::atomic<float> _progress{ 0.0f };
+        std::atomic<bool> _cancel{ false };
     public:
         bool addFont(const std::string_view name, const std::string_view path, uint32_t face, uint32_t size);
+        bool addFont(const std::string_view name, const std::string_view path, uint32_t face, std::vector<uint32_t> size);
+        bool addFont(const std::string_view name, const std::string_view path, uint32_t face, std::vector<uint32_t> size,
+            const FontVariation& variation);
+        bool addFallback(const std::string_view name, const std::string_view fallback);
         bool addCode(const std::string_view name, uint32_t c);
         bool addRange(const std::string_view name, uint32_t a, uint32_t b);
+        bool addCodes(const std::string_view name, std::vector<uint32_t> codes); // any order, duplicates allowed
+        bool addCodeSet(const std::string_view name, const CodeSet& set); // merged by ranges, the set is not kept
+        bool addAvailableRange(const std::string_view name, uint32_t a, uint32_t b); // only code points present in the font cmap
         bool addText(const std::string_view name, const std::string_view text);
         void setImageFileFormat(ImageFileFormat format);
         void setMultiChannelEnable(bool v);
+        void setKerningEnable(bool v); // export kerning pairs between the glyphs of each font
+        void setMipmapLevels(uint32_t levels); // glyphs stay separated down to this mip level, 0 disables mipmaps
+        void setGlyphImageMode(GlyphImageMode mode, uint32_t spread = 4); // spread in pixel, glyph_edge is raised to at least spread
+        void setStroke(StrokeMode mode, float width = 1.0f, StrokeJoin join = StrokeJoin::Round); // width in pixel
+        void setShadow(ShadowMode mode, float radius = 2.0f, int32_t offset_x = 1, int32_t offset_y = 1); // in pixel, y down
+        void setMemoryBudget(uint64_t bytes); // glyph bitmaps beyond the budget are spilled to a temporary file, 0 disables
+        void setIncremental(bool v); // keep the layout in the process, the next build to the same path only adds new code points
         bool build(const std::string_view path,
             uint32_t texture_width, uint32_t texture_height, uint32_t texture_edge,
             uint32_t glyph_edge);
+        double stageTime(BuildStage stage); // wall time in seconds spent in the stage by the last build
+        float progress(); // 0 to 1 of the running build, may be read from any thread
+        void setCancel(bool v); // while set, build stops at the next glyph batch or page and returns false, any thread
+        const BuildStats& stats(); // statistics of the last build, partial when it failed
     };
 }
@@ -0,0 +1,207 @@
+#include "codeset.hpp"
+#include <cassert>
+#include <algorithm>
+
+namespace fontatlas
+{
+    void CodeSet::add(uint32_t c)
+    {
+        add(c, c);
+    }
+    void CodeSet::add(uint32_t a, uint32_t b)
+    {
+        if (a > b)
+        {
+            return;
+        }
+        // first range which touches or follows [a, b]
+        auto first_ = std::lower_bound(_range.begin(), _range.begin() + _count(), a,
+            [](const Range& r, uint32_t v) { return (uint64_t)r.last + 1 < v; });
+        // ranges in [first_, last_) are overlapped or adjacent, merge them
+        auto last_ = first_;
+        while (last_ != _range.begin() + _count() && (uint64_t)last_->first <= (uint64_t)b + 1)
+        {
+            a = std::min(a, last_->first);
+            b = std::max(b, last_->last);
+            ++last_;
+        }
+        if (first_ == last_)
+        {
+            _range.insert(first_, Range{ a, b });
+        }
+        else
+        {
+            first_->first = a;
+            first_->last = b;
+            _range.erase(first_ + 1, last_);
+        }
+    }
+    void CodeSet::add(std::vector<uint32_t> codes)
+    {
+        std::sort(codes.begin(), codes.end());
+        CodeSet set_;
+        set_._range.clear();
+        for (uint32_t c : codes)
+        {
+            if (!set_._range.empty() && (uint64_t)set_._range.back().last + 1 >= c)
+            {
+                set_._range.back().last = std::max(set_._range.back().last, c);
+            }
+            else
+            {
+                set_._range.push_back(Range{ c, c });
+            }
+        }
+        set_._range.push_back(Range{ 0, 0 });
+        merge(set_);
+    }
+    void CodeSet::merge(const CodeSet& right)
+    {
+        if (right.empty())
+        {
+            return;
+        }
+        if (empty())
+        {
+            _range = right._range;
+            return;
+        }
+        std::vector<Range> result_;
+        result_.reserve(_count() + right._count() + 1);
+        auto push_ = [&](const Range& r)
+        {
+            if (!result_.empty() && (uint64_t)result_.back().last + 1 >= r.first)
+            {
+                result_.back().last = std::max(result_.back().last, r.last);
+            }
+            else
+            {
+                result_.push_back(r);
+            }
+        };
+        size_t i = 0;
+        size_t j = 0;
+        while (i < _count() && j < right._count())
+        {
+            if (_range[i].first <= right._range[j].first)
+            {
+                push_(_range[i++]);
+            }
+            else
+            {
+                push_(right._range[j++]);
+            }
+        }
+        while (i < _count())
+        {
+            push_(_range[i++]);
+        }
+        while (j < right._count())
+        {
+            push_(right._range[j++]);
+        }
+        result_.push_back(Range{ 0, 0 });
+        _range = std::move(result_);
+    }
+    void CodeSet::intersect(const CodeSet& right)
+    {
+        std::vector<Range> result_;
+        size_t i = 0;
+        size_t j = 0;
+        while (i < _count() && j < right._count())
+        {
+            const uint32_t first_ = std::max(_range[i].first, right._range[j].first);
+            const uint32_t last_ = std::min(_range[i].last, right._range[j].last);
+            if (first_ <= last_)
+            {
+                result_.push_back(Range{ first_, last_ });
+            }
+            // drop the range which ends first
+            if (_range[i].last < right._range[j].last)
+            {
+                i += 1;
+            }
+            else
+            {
+                j += 1;
+            }
+        }
+        result_.push_back(Range{ 0, 0 });
+        _range = std::move(result_);
+    }
+    void CodeSet::subtract(const CodeSet& right)
+    {
+        std::vector<Range> result_;
+        result_.reserve(_count() + right._count() + 1);
+        size_t j = 0;
+        for (size_t i = 0; i < _count(); i += 1)
+        {
+            // 64 bit, the code after a removed range may be past the last code point
+            uint64_t first_ = _range[i].first;
+            const uint32_t last_ = _range[i].last;
+            while (j < right._count() && right._range[j].last < first_)
+            {
+                j += 1;
+            }
+            // j is not advanced past a range that may still cover the next range of this set
+            for (size_t k = j; k < right._count() && right._range[k].first <= last_ && first_ <= last_; k += 1)
+            {
+                if (right._range[k].first > first_)
+                {
+                    result_.push_back(Range{ (uint32_t)first_, right._range[k].first - 1 });
+                }
+                first_ = (uint64_t)right._range[k].last + 1;
+            }
+            if (first_ <= last_)
+            {
+                result_.push_back(Range{ (uint32_t)first_, last_ });
+            }
+        }
+        result_.push_back(Range{ 0, 0 });
+        _range = std::move(result_);
+    }
+    bool CodeSet::contains(uint32_t c) const
+    {
+        auto it = std::lower_bound(_range.begin(), _range.begin() + _count(), c,
+            [](const Range& r, uint32_t v) { return r.last < v; });
+        return it != _range.begin() + _count() && it->first <= c;
+    }
+    bool CodeSet::empty() const
+    {
+        return _count() == 0;
+    }
+    size_t CodeSet::size() const
+    {
+        size_t n = 0;
+        for (size_t idx = 0; idx < _count(); idx += 1)
+        {
+            n += (size_t)_range[idx].last - (size_t)_range[idx].first + 1;
+        }
+        return n;
+    }
+    size_t CodeSet::rangeCount() const
+    {
+        return _count();
+    }
+    const CodeSet::Range* CodeSet::rangeData() const
+    {
+        return _range.data();
+    }
+    void CodeSet::clear()
+    {
+        _range.clear();
+        _range.push_back(Range{ 0, 0 });
+    }
+    CodeSet::iterator CodeSet::begin() const
+    {
+        return iterator(_range.data(), _range.front().first);
+    }
+    CodeSet::iterator CodeSet::end() const
+    {
+        return iterator(_range.data() + _count(), _range.back().first);
+    }
+    CodeSet::CodeSet()
+    {
+        clear();
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <iterator>
+
+namespace fontatlas
+{
+    // set of code points stored as sorted, disjoint and non-adjacent closed intervals
+    class CodeSet
+    {
+    public:
+        struct Range
+        {
+            uint32_t first;
+            uint32_t last;
+        };
+        
+        class iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = uint32_t;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const uint32_t*;
+            using reference = uint32_t;
+        private:
+            const Range* _range = nullptr;
+            uint32_t _code = 0;
+        public:
+            uint32_t operator*() const { return _code; }
+            iterator& operator++()
+            {
+                if (_code == _range->last)
+                {
+                    _range += 1;
+                    _code = _range->first; // the range list always ends with a sentinel
+                }
+                else
+                {
+                    _code += 1;
+                }
+                return *this;
+            }
+            bool operator==(const iterator& right) const { return _range == right._range && _code == right._code; }
+            bool operator!=(const iterator& right) const { return !(*this == right); }
+        public:
+            iterator() = default;
+            iterator(const Range* range, uint32_t code) : _range(range), _code(code) {}
+        };
+    private:
+        std::vector<Range> _range; // always ends with one sentinel entry
+    private:
+        size_t _count() const { return _range.size() - 1; }
+    public:
+        void add(uint32_t c);
+        void add(uint32_t a, uint32_t b);
+        void add(std::vector<uint32_t> codes);
+        void merge(const CodeSet& right);
+        void intersect(const CodeSet& right);
+        void subtract(const CodeSet& right);
+        bool contains(uint32_t c) const;
+        bool empty() const;
+        size_t size() const;
+        size_t rangeCount() const;
+        const Range* rangeData() const;
+        void clear();
+        iterator begin() const;
+        iterator end() const;
+    public:
+        CodeSet();
+    };
+}
@@ -3,6 +3,7 @@
 #define  WIN32_LEAN_AND_MEAN
 #define  NOMINMAX
 #include <Windows.h>
+#include <Psapi.h>
 #include <wrl.h>
 
 namespace fontatlas
@@ -78,6 +79,35 @@ namespace fontatlas
         return std::move(buffer);
     }
     
+    bool replaceFile(const std::wstring_view from, const std::wstring_view to)
+    {
+        const std::wstring from_(from);
+        const std::wstring to_(to);
+        return MoveFileExW(from_.c_str(), to_.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+    }
+    double processCpuTime()
+    {
+        FILETIME creation_ = {}, exit_ = {}, kernel_ = {}, user_ = {};
+        if (!GetProcessTimes(GetCurrentProcess(), &creation_, &exit_, &kernel_, &user_))
+        {
+            return 0.0;
+        }
+        // 100 ns units
+        const uint64_t kernel_time_ = ((uint64_t)kernel_.dwHighDateTime << 32) | kernel_.dwLowDateTime;
+        const uint64_t user_time_ = ((uint64_t)user_.dwHighDateTime << 32) | user_.dwLowDateTime;
+        return (double)(kernel_time_ + user_time_) * 1e-7;
+    }
+    size_t processPeakMemory()
+    {
+        PROCESS_MEMORY_COUNTERS counters_ = {};
+        counters_.cb = sizeof(counters_);
+        if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters_, sizeof(counters_)))
+        {
+            return 0;
+        }
+        return counters_.PeakWorkingSetSize;
+    }
+    
     ScopeCoInitialize::ScopeCoInitialize() : _init(false)
     {
         HRESULT hr = CoInitializeEx(0, COINIT_MULTITHREADED);
@@ -13,6 +13,11 @@ namespace fontatlas
     Buffer readFile(const std::string_view  path);
     Buffer readFile(const std::wstring_view path);
     
+    bool replaceFile(const std::wstring_view from, const std::wstring_view to); // rename over an existing file, atomic on one volume
+    
+    double processCpuTime(); // user and kernel time of all threads in seconds
+    size_t processPeakMemory(); // peak working set in bytes
+    
     class ScopeCoInitialize
     {
     private:
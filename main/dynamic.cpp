@@ -0,0 +1,312 @@
+#include "dynamic.hpp"
+#include "common.hpp"
+#include "raster.hpp"
+#include "logger.hpp"
+#include "utf.hpp"
+#include <algorithm>
+#include <filesystem>
+#include "ft2build.h"
+#include FT_FREETYPE_H
+
+namespace fontatlas
+{
+    // transparent white, so bilinear filtering at glyph borders does not darken the edge
+    static const Color page_background_(255, 255, 255, 0);
+    
+    int32_t DynamicAtlas::addFont(const std::string_view name, const std::string_view path, uint32_t face, uint32_t size)
+    {
+        if (size == 0 || font(name) >= 0 || !std::filesystem::is_regular_file(toWide(path)))
+        {
+            return -1;
+        }
+        FontConfig cfg_ = {};
+        cfg_.name = name;
+        cfg_.id = FontCache::get().faceID(path, face);
+        cfg_.size = size;
+        FontCache::Lease ft_ = FontCache::get().acquire();
+        if (!ft_ || ft_->size(cfg_.id, size) == NULL)
+        {
+            return -1;
+        }
+        _font.push_back(std::move(cfg_));
+        return (int32_t)_font.size() - 1;
+    }
+    bool DynamicAtlas::addFallback(const std::string_view name, const std::string_view fallback)
+    {
+        const int32_t font_ = font(name);
+        const int32_t fallback_ = font(fallback);
+        if (font_ < 0 || fallback_ < 0 || font_ == fallback_)
+        {
+            return false;
+        }
+        auto& list_ = _font[font_].fallback;
+        if (std::find(list_.begin(), list_.end(), (uint32_t)fallback_) == list_.end())
+        {
+            list_.push_back((uint32_t)fallback_);
+        }
+        return true;
+    }
+    int32_t DynamicAtlas::font(const std::string_view name)
+    {
+        for (size_t i = 0; i < _font.size(); i += 1)
+        {
+            if (_font[i].name == name)
+            {
+                return (int32_t)i;
+            }
+        }
+        return -1;
+    }
+    
+    bool DynamicAtlas::_pack(Page& page, uint32_t width, uint32_t height, uint32_t& x, uint32_t& y)
+    {
+        // best fitting shelf, shelves are not taller than 1.5 times the glyph to limit waste
+        Shelf* best_ = nullptr;
+        for (auto& v : page.shelf)
+        {
+            if (v.height >= height && v.height <= height + height / 2 && v.x + width <= _width
+                && (best_ == nullptr || v.height < best_->height))
+            {
+                best_ = &v;
+            }
+        }
+        if (best_ == nullptr)
+        {
+            // open a new shelf, heights are rounded up so similar glyphs share it
+            const uint32_t shelf_height_ = std::min((height + 3u) & ~3u, _height);
+            if (page.bottom + shelf_height_ > _height || width > _width)
+            {
+                return false;
+            }
+            page.shelf.push_back(Shelf{ page.bottom, shelf_height_, 0 });
+            page.bottom += shelf_height_;
+            best_ = &page.shelf.back();
+        }
+        x = best_->x;
+        y = best_->y;
+        best_->x += width;
+        return true;
+    }
+    void DynamicAtlas::_evict(uint32_t index)
+    {
+        Page& page_ = *_page[index];
+        for (uint64_t key : page_.glyph)
+        {
+            _glyph.erase(key);
+        }
+        page_.glyph.clear();
+        page_.shelf.clear();
+        page_.bottom = 0;
+        page_.texture.clear(page_background_);
+        // the whole page is uploaded again
+        page_.dirty_x0 = 0;
+        page_.dirty_y0 = 0;
+        page_.dirty_x1 = _width;
+        page_.dirty_y1 = _height;
+    }
+    bool DynamicAtlas::_allocate(uint32_t width, uint32_t height, uint32_t& page, uint32_t& x, uint32_t& y)
+    {
+        // most recently used pages first, they are the most likely to have room for the same text
+        for (uint32_t i = (uint32_t)_page.size(); i > 0; i -= 1)
+        {
+            if (_pack(*_page[i - 1], width, height, x, y))
+            {
+                page = i - 1;
+                return true;
+            }
+        }
+        if (_page.size() < _maxpages)
+        {
+            _page.push_back(std::make_unique<Page>(_width, _height));
+            Page& page_ = *_page.back();
+            page_.texture.clear(page_background_);
+            page_.dirty_x1 = _width;
+            page_.dirty_y1 = _height;
+            page = (uint32_t)_page.size() - 1;
+            return _pack(page_, width, height, x, y);
+        }
+        // budget reached, reuse the least recently used page that is not needed by this frame
+        uint32_t lru_ = (uint32_t)_page.size();
+        for (uint32_t i = 0; i < _page.size(); i += 1)
+        {
+            if (_page[i]->used < _frame && (lru_ == _page.size() || _page[i]->used < _page[lru_]->used))
+            {
+                lru_ = i;
+            }
+        }
+        if (lru_ == _page.size())
+        {
+            return false;
+        }
+        _evict(lru_);
+        page = lru_;
+        return _pack(*_page[lru_], width, height, x, y);
+    }
+    const DynamicAtlas::Glyph* DynamicAtlas::_render(FontCache::Context& ft, uint32_t font, uint32_t code)
+    {
+        const uint64_t key_ = ((uint64_t)font << 32) | code;
+        // the font itself first, then its fallback chain
+        uint32_t source_ = font;
+        FT_UInt index_ = ft.charIndex(_font[font].id, code);
+        for (size_t i = 0; index_ == 0 && i < _font[font].fallback.size(); i += 1)
+        {
+            source_ = _font[font].fallback[i];
+            index_ = ft.charIndex(_font[source_].id, code);
+        }
+        if (index_ == 0)
+        {
+            _missing.insert(key_);
+            return nullptr;
+        }
+        FT_Face ftface_ = ft.size(_font[source_].id, _font[source_].size);
+        GlyphImage image_;
+        if (ftface_ == NULL
+            || FT_Load_Glyph(ftface_, index_, FT_LOAD_DEFAULT) != FT_Err_Ok
+            || FT_Render_Glyph(ftface_->glyph, FT_RENDER_MODE_NORMAL) != FT_Err_Ok
+            || !copyGlyphImage(ftface_->glyph, _edge, image_))
+        {
+            _missing.insert(key_);
+            return nullptr;
+        }
+        if (image_.width > _width || image_.height > _height)
+        {
+            logger::warn("dynamic atlas: U+%04X is larger than a page\n", code);
+            _missing.insert(key_);
+            return nullptr;
+        }
+        uint32_t page_ = 0, x_ = 0, y_ = 0;
+        if (!_allocate(image_.width, image_.height, page_, x_, y_))
+        {
+            logger::warn("dynamic atlas: no room for U+%04X, every page is in use by this frame\n", code);
+            return nullptr;
+        }
+        Page& p_ = *_page[page_];
+        for (uint32_t y = 0; y < image_.height; y += 1)
+        {
+            const uint8_t* src_ = image_.row(y);
+            for (uint32_t x = 0; x < image_.width; x += 1)
+            {
+                p_.texture.pixel(x_ + x, y_ + y) = Color(255, 255, 255, src_[x]);
+            }
+        }
+        if (p_.dirty_x1 <= p_.dirty_x0)
+        {
+            p_.dirty_x0 = x_;
+            p_.dirty_y0 = y_;
+            p_.dirty_x1 = x_ + image_.width;
+            p_.dirty_y1 = y_ + image_.height;
+        }
+        else
+        {
+            p_.dirty_x0 = std::min(p_.dirty_x0, x_);
+            p_.dirty_y0 = std::min(p_.dirty_y0, y_);
+            p_.dirty_x1 = std::max(p_.dirty_x1, x_ + image_.width);
+            p_.dirty_y1 = std::max(p_.dirty_y1, y_ + image_.height);
+        }
+        p_.used = _frame;
+        p_.glyph.push_back(key_);
+        const float offset_xy = (float)image_.padding;
+        Glyph glyph_ = {};
+        glyph_.page = page_;
+        glyph_.x = x_;
+        glyph_.y = y_;
+        glyph_.width = image_.width;
+        glyph_.height = image_.height;
+        glyph_.draw_width  = image_.metrics_width  + 2.0f * offset_xy;
+        glyph_.draw_height = image_.metrics_height + 2.0f * offset_xy;
+        glyph_.h_pen_x = image_.h_bearing_x - offset_xy;
+        glyph_.h_pen_y = image_.h_bearing_y + offset_xy;
+        glyph_.h_advance = image_.h_advance;
+        glyph_.v_pen_x = image_.v_bearing_x - offset_xy;
+        glyph_.v_pen_y = image_.v_bearing_y + offset_xy;
+        glyph_.v_advance = image_.v_advance;
+        return &_glyph.emplace(key_, glyph_).first->second;
+    }
+    const DynamicAtlas::Glyph* DynamicAtlas::_find(int32_t font, uint32_t code, std::optional<FontCache::Lease>& ft)
+    {
+        if (font < 0 || (size_t)font >= _font.size())
+        {
+            return nullptr;
+        }
+        const uint64_t key_ = ((uint64_t)font << 32) | code;
+        auto it = _glyph.find(key_);
+        if (it != _glyph.end())
+        {
+            _page[it->second.page]->used = _frame;
+            return &it->second;
+        }
+        if (_missing.count(key_) > 0)
+        {
+            return nullptr;
+        }
+        if (!ft)
+        {
+            ft.emplace(FontCache::get().acquire());
+        }
+        if (!*ft)
+        {
+            return nullptr;
+        }
+        return _render(**ft, (uint32_t)font, code);
+    }
+    const DynamicAtlas::Glyph* DynamicAtlas::glyph(int32_t font, uint32_t code)
+    {
+        std::optional<FontCache::Lease> ft_;
+        return _find(font, code, ft_);
+    }
+    bool DynamicAtlas::prepare(int32_t font, const std::string_view text)
+    {
+        // one lease for all misses of the text
+        std::optional<FontCache::Lease> ft_;
+        bool ok_ = true;
+        char32_t c = 0;
+        utf::utf8reader reader(text.data(), text.size());
+        while (reader(c))
+        {
+            const uint64_t key_ = ((uint64_t)font << 32) | (uint32_t)c;
+            if (_find(font, (uint32_t)c, ft_) == nullptr && _missing.count(key_) == 0)
+            {
+                ok_ = false;
+            }
+        }
+        return ok_;
+    }
+    void DynamicAtlas::nextFrame()
+    {
+        _frame += 1;
+    }
+    void DynamicAtlas::collectDirtyRects(std::vector<DirtyRect>& rects)
+    {
+        for (uint32_t i = 0; i < _page.size(); i += 1)
+        {
+            Page& p_ = *_page[i];
+            if (p_.dirty_x1 > p_.dirty_x0 && p_.dirty_y1 > p_.dirty_y0)
+            {
+                rects.push_back(DirtyRect{ i, p_.dirty_x0, p_.dirty_y0,
+                    p_.dirty_x1 - p_.dirty_x0, p_.dirty_y1 - p_.dirty_y0 });
+            }
+            p_.dirty_x0 = p_.dirty_y0 = p_.dirty_x1 = p_.dirty_y1 = 0;
+        }
+    }
+    uint32_t DynamicAtlas::pageCount()
+    {
+        return (uint32_t)_page.size();
+    }
+    Texture& DynamicAtlas::page(uint32_t index)
+    {
+        return _page[index]->texture;
+    }
+    size_t DynamicAtlas::glyphCount()
+    {
+        return _glyph.size();
+    }
+    
+    DynamicAtlas::DynamicAtlas(uint32_t page_width, uint32_t page_height, size_t memory_budget, uint32_t glyph_edge)
+        : _width(std::max(page_width, 1u))
+        , _height(std::max(page_height, 1u))
+        , _edge(glyph_edge)
+    {
+        const size_t page_bytes_ = (size_t)_width * _height * sizeof(Color);
+        _maxpages = (uint32_t)std::max<size_t>(memory_budget / page_bytes_, 1);
+    }
+}
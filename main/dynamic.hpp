@@ -0,0 +1,114 @@
+#pragma once
+#include "texture.hpp"
+#include "fontcache.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace fontatlas
+{
+    // glyph atlas filled on first use at runtime, pages are evicted least recently used first
+    // when the memory budget is reached, not thread safe
+    // a FontCache context is only leased while glyphs are rendered, so other users of the cache are not
+    // starved by a long living atlas
+    class DynamicAtlas
+    {
+    public:
+        struct Glyph
+        {
+            uint32_t page; // index of the page texture
+            // on texture, in texel
+            uint32_t x;
+            uint32_t y;
+            uint32_t width;
+            uint32_t height;
+            // on drawing, same meaning as the index written by Builder
+            float draw_width;
+            float draw_height;
+            float h_pen_x;
+            float h_pen_y;
+            float h_advance;
+            float v_pen_x;
+            float v_pen_y;
+            float v_advance;
+        };
+        // texels changed since the last collectDirtyRects, upload only these
+        struct DirtyRect
+        {
+            uint32_t page;
+            uint32_t x;
+            uint32_t y;
+            uint32_t width;
+            uint32_t height;
+        };
+    private:
+        struct FontConfig
+        {
+            std::string name;
+            uint32_t id; // FontCache face id
+            uint32_t size;
+            std::vector<uint32_t> fallback; // index in _font
+        };
+        struct Shelf
+        {
+            uint32_t y;
+            uint32_t height;
+            uint32_t x; // next free x
+        };
+        struct Page
+        {
+            Texture texture;
+            std::vector<Shelf> shelf;
+            uint32_t bottom = 0; // top of the free area below the shelves
+            uint64_t used = 0;   // frame of the last lookup
+            std::vector<uint64_t> glyph; // keys of the glyphs on this page
+            uint32_t dirty_x0 = 0;
+            uint32_t dirty_y0 = 0;
+            uint32_t dirty_x1 = 0; // empty when x1 <= x0
+            uint32_t dirty_y1 = 0;
+            
+            Page(uint32_t width, uint32_t height) : texture(width, height) {}
+        };
+    private:
+        std::vector<FontConfig> _font;
+        std::vector<std::unique_ptr<Page>> _page;
+        std::unordered_map<uint64_t, Glyph> _glyph; // font << 32 | code
+        std::unordered_set<uint64_t> _missing; // glyphs not in any font of the chain, not retried
+        uint32_t _width;
+        uint32_t _height;
+        uint32_t _edge;
+        uint32_t _maxpages;
+        uint64_t _frame = 1;
+    private:
+        bool _allocate(uint32_t width, uint32_t height, uint32_t& page, uint32_t& x, uint32_t& y);
+        bool _pack(Page& page, uint32_t width, uint32_t height, uint32_t& x, uint32_t& y);
+        void _evict(uint32_t page);
+        const Glyph* _render(FontCache::Context& ft, uint32_t font, uint32_t code);
+        const Glyph* _find(int32_t font, uint32_t code, std::optional<FontCache::Lease>& ft); // leases ft on a miss
+    public:
+        // returns the font handle, -1 if the file can not be used
+        int32_t addFont(const std::string_view name, const std::string_view path, uint32_t face, uint32_t size);
+        bool addFallback(const std::string_view name, const std::string_view fallback);
+        int32_t font(const std::string_view name);
+        // look up a glyph, rendered and packed on the first use, nullptr if the font has no glyph for code
+        // or every page is in use by the current frame, the pointer is valid until the next lookup
+        const Glyph* glyph(int32_t font, uint32_t code);
+        // render all glyphs of an utf-8 string ahead of use, returns false if any of them could not be placed
+        bool prepare(int32_t font, const std::string_view text);
+        // pages used in the current frame are never evicted
+        void nextFrame();
+        void collectDirtyRects(std::vector<DirtyRect>& rects);
+        uint32_t pageCount();
+        Texture& page(uint32_t index);
+        size_t glyphCount();
+    public:
+        // memory_budget is in bytes of page pixels, at least one page is always kept
+        DynamicAtlas(uint32_t page_width, uint32_t page_height, size_t memory_budget, uint32_t glyph_edge = 1);
+        DynamicAtlas(const DynamicAtlas&) = delete;
+    };
+}
@@ -0,0 +1,388 @@
+#include "fontcache.hpp"
+#include "common.hpp"
+#include "logger.hpp"
+#include <cassert>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+namespace fontatlas
+{
+    constexpr FT_UInt cache_max_faces = 16;
+    constexpr FT_UInt cache_max_sizes = 64;
+    constexpr FT_ULong cache_max_bytes = 4 * 1024 * 1024;
+    
+    inline FTC_FaceID toFaceID(uint32_t id)
+    {
+        return reinterpret_cast<FTC_FaceID>(static_cast<uintptr_t>(id));
+    }
+    
+    bool FontCache::Context::valid()
+    {
+        return _library != NULL && _manager != NULL && _cmap != NULL;
+    }
+    FT_Library FontCache::Context::library()
+    {
+        return _library;
+    }
+    FT_Face FontCache::Context::face(uint32_t id)
+    {
+        FT_Face face_ = NULL;
+        if (FTC_Manager_LookupFace(_manager, toFaceID(id), &face_) != FT_Err_Ok)
+        {
+            return NULL;
+        }
+        return face_;
+    }
+    FT_Face FontCache::Context::size(uint32_t id, uint32_t size)
+    {
+        FTC_ScalerRec scaler_ = {};
+        scaler_.face_id = toFaceID(id);
+        scaler_.width = size * 64;
+        scaler_.height = size * 64;
+        scaler_.pixel = 0;
+        scaler_.x_res = 72;
+        scaler_.y_res = 72;
+        FT_Size size_ = NULL;
+        if (FTC_Manager_LookupSize(_manager, &scaler_, &size_) != FT_Err_Ok)
+        {
+            return NULL;
+        }
+        return size_->face;
+    }
+    FT_UInt FontCache::Context::charIndex(uint32_t id, uint32_t code)
+    {
+        return FTC_CMapCache_Lookup(_cmap, toFaceID(id), -1, code);
+    }
+    bool FontCache::Context::charset(uint32_t id, CodeSet& set)
+    {
+        FT_Face face_ = face(id);
+        if (face_ == NULL || face_->charmap == NULL)
+        {
+            return false;
+        }
+        std::vector<uint32_t> code_;
+        code_.reserve(face_->num_glyphs);
+        FT_UInt gidx = 0;
+        FT_ULong c = FT_Get_First_Char(face_, &gidx);
+        while (gidx != 0)
+        {
+            code_.push_back((uint32_t)c);
+            c = FT_Get_Next_Char(face_, c, &gidx);
+        }
+        set.add(std::move(code_));
+        return true;
+    }
+    void FontCache::Context::removeFace(uint32_t id)
+    {
+        FTC_Manager_RemoveFaceID(_manager, toFaceID(id));
+    }
+    FontCache::Context::Context(FontCache* cache)
+    {
+        if (FT_Init_FreeType(&_library) != FT_Err_Ok)
+        {
+            _library = NULL;
+            return;
+        }
+        if (FTC_Manager_New(_library, cache_max_faces, cache_max_sizes, cache_max_bytes,
+            &FontCache::_requestFace, cache, &_manager) != FT_Err_Ok)
+        {
+            _manager = NULL;
+            return;
+        }
+        if (FTC_CMapCache_New(_manager, &_cmap) != FT_Err_Ok)
+        {
+            _cmap = NULL;
+            return;
+        }
+    }
+    FontCache::Context::~Context()
+    {
+        if (_manager)
+        {
+            FTC_Manager_Done(_manager); // also release all cached face and size
+            _manager = NULL;
+            _cmap = NULL;
+        }
+        if (_library)
+        {
+            FT_Done_FreeType(_library);
+            _library = NULL;
+        }
+    }
+    
+    FontCache::Lease::Lease(FontCache* cache, Context* context)
+        : _cache(cache), _context(context)
+    {
+    }
+    FontCache::Lease::Lease(Lease&& right) noexcept
+        : _cache(right._cache), _context(right._context)
+    {
+        right._cache = nullptr;
+        right._context = nullptr;
+    }
+    FontCache::Lease::~Lease()
+    {
+        if (_cache && _context)
+        {
+            _cache->_release(_context);
+        }
+        _cache = nullptr;
+        _context = nullptr;
+    }
+    
+    FT_Error FontCache::_requestFace(FTC_FaceID face_id, FT_Library library, FT_Pointer req_data, FT_Face* aface)
+    {
+        FontCache* self = static_cast<FontCache*>(req_data);
+        const uint32_t id = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(face_id));
+        const FaceSource source_ = self->faceSource(id);
+        if (source_.path.empty())
+        {
+            return FT_Err_Invalid_Argument;
+        }
+        FT_Error fterr_ = FT_Err_Ok;
+        if (source_.instance.empty() && source_.axis.empty())
+        {
+            fterr_ = FT_New_Face(library, source_.path.c_str(), source_.face, aface);
+        }
+        else
+        {
+            // every instance is a face object of its own, the file is read once
+            auto data_ = self->fileData(source_.path);
+            fterr_ = data_ ? _openVariation(library, source_, data_, aface) : FT_Err_Cannot_Open_Resource;
+        }
+        if (fterr_ != FT_Err_Ok)
+        {
+            logger::error("open font \"%s\" (face %u) failed\n", source_.path.c_str(), source_.face);
+        }
+        return fterr_;
+    }
+    FT_Error FontCache::_openVariation(FT_Library library, const FaceSource& source,
+        const std::shared_ptr<const std::vector<FT_Byte>>& file_data, FT_Face* aface)
+    {
+        const std::vector<FT_Byte>& data = *file_data;
+        FT_Error fterr_ = FT_New_Memory_Face(library, data.data(), (FT_Long)data.size(), source.face, aface);
+        if (fterr_ != FT_Err_Ok)
+        {
+            return fterr_;
+        }
+        if (!source.instance.empty())
+        {
+            // named instances are selected by face index, bits 16-30
+            const FT_Long count_ = (*aface)->style_flags >> 16;
+            FT_Face instance_ = NULL;
+            for (FT_Long i = 1; i <= count_ && instance_ == NULL; i += 1)
+            {
+                FT_Face face_ = NULL;
+                if (FT_New_Memory_Face(library, data.data(), (FT_Long)data.size(),
+                    (i << 16) | (FT_Long)source.face, &face_) != FT_Err_Ok)
+                {
+                    continue;
+                }
+                if (face_->style_name && source.instance == face_->style_name)
+                {
+                    instance_ = face_;
+                }
+                else
+                {
+                    FT_Done_Face(face_);
+                }
+            }
+            FT_Done_Face(*aface);
+            *aface = instance_;
+            if (instance_ == NULL)
+            {
+                logger::error("font \"%s\" has no named instance \"%s\"\n", source.path.c_str(), source.instance.c_str());
+                return FT_Err_Invalid_Argument;
+            }
+        }
+        if (!source.axis.empty())
+        {
+            FT_MM_Var* mm_ = NULL;
+            fterr_ = FT_Get_MM_Var(*aface, &mm_);
+            if (fterr_ != FT_Err_Ok)
+            {
+                logger::error("font \"%s\" is not a variable font\n", source.path.c_str());
+                FT_Done_Face(*aface);
+                *aface = NULL;
+                return fterr_;
+            }
+            // start from the current instance, unlisted axes keep their value
+            std::vector<FT_Fixed> coords_(mm_->num_axis);
+            FT_Get_Var_Design_Coordinates(*aface, mm_->num_axis, coords_.data());
+            for (auto& v : source.axis)
+            {
+                bool found_ = false;
+                for (FT_UInt i = 0; i < mm_->num_axis; i += 1)
+                {
+                    const FT_Var_Axis& axis_ = mm_->axis[i];
+                    if (axis_.tag == v.first)
+                    {
+                        const FT_Fixed value_ = (FT_Fixed)(v.second * 65536.0f);
+                        coords_[i] = std::clamp(value_, axis_.minimum, axis_.maximum);
+                        found_ = true;
+                    }
+                }
+                if (!found_)
+                {
+                    logger::warn("font \"%s\" has no axis '%c%c%c%c'\n", source.path.c_str(),
+                        (char)(v.first >> 24), (char)(v.first >> 16), (char)(v.first >> 8), (char)v.first);
+                }
+            }
+            fterr_ = FT_Set_Var_Design_Coordinates(*aface, mm_->num_axis, coords_.data());
+            FT_Done_MM_Var(library, mm_);
+            if (fterr_ != FT_Err_Ok)
+            {
+                FT_Done_Face(*aface);
+                *aface = NULL;
+                return fterr_;
+            }
+        }
+        // memory faces read the buffer until FT_Done_Face, which may come after invalidate dropped it from _filedata
+        (*aface)->generic.data = new std::shared_ptr<const std::vector<FT_Byte>>(file_data);
+        (*aface)->generic.finalizer = &_releaseFileData;
+        return FT_Err_Ok;
+    }
+    void FontCache::_releaseFileData(void* object)
+    {
+        FT_Face face_ = static_cast<FT_Face>(object);
+        delete static_cast<std::shared_ptr<const std::vector<FT_Byte>>*>(face_->generic.data);
+        face_->generic.data = NULL;
+    }
+    void FontCache::_release(Context* context)
+    {
+        std::scoped_lock lock_(_lock);
+        auto it = _stale.find(context);
+        if (it != _stale.end())
+        {
+            for (uint32_t id : it->second)
+            {
+                context->removeFace(id);
+            }
+            _stale.erase(it);
+        }
+        _idle.push_back(context);
+    }
+    uint32_t FontCache::faceID(const std::string_view path, uint32_t face)
+    {
+        FaceSource source_;
+        source_.path = path;
+        source_.face = face;
+        return faceID(source_);
+    }
+    uint32_t FontCache::faceID(const FaceSource& source)
+    {
+        std::scoped_lock lock_(_lock);
+        for (size_t idx = 0; idx < _source.size(); idx += 1)
+        {
+            const FaceSource& v = _source[idx];
+            if (v.face == source.face && v.path == source.path
+                && v.instance == source.instance && v.axis == source.axis)
+            {
+                return static_cast<uint32_t>(idx + 1);
+            }
+        }
+        _source.push_back(source);
+        return static_cast<uint32_t>(_source.size()); // 0 is reserved, FTC_FaceID must not be NULL
+    }
+    FontCache::FaceSource FontCache::faceSource(uint32_t id)
+    {
+        std::scoped_lock lock_(_lock);
+        if (id == 0 || id > _source.size())
+        {
+            return FaceSource{};
+        }
+        return _source[id - 1];
+    }
+    std::shared_ptr<const std::vector<FT_Byte>> FontCache::fileData(const std::string& path)
+    {
+        std::scoped_lock lock_(_lock);
+        auto it = _filedata.find(path);
+        if (it != _filedata.end())
+        {
+            return it->second;
+        }
+        std::ifstream file_(toWide(path), std::ios::binary | std::ios::in);
+        if (!file_.is_open())
+        {
+            return nullptr;
+        }
+        auto data_ = std::make_shared<std::vector<FT_Byte>>(
+            std::istreambuf_iterator<char>(file_), std::istreambuf_iterator<char>());
+        _filedata.emplace(path, data_);
+        return data_;
+    }
+    std::shared_ptr<const CodeSet> FontCache::charset(uint32_t id)
+    {
+        {
+            std::scoped_lock lock_(_lock);
+            auto it = _charset.find(id);
+            if (it != _charset.end())
+            {
+                return it->second;
+            }
+        }
+        Lease ctx_ = acquire();
+        if (!ctx_)
+        {
+            return nullptr;
+        }
+        auto set_ = std::make_shared<CodeSet>();
+        if (!ctx_->charset(id, *set_))
+        {
+            return nullptr;
+        }
+        std::scoped_lock lock_(_lock);
+        _charset.emplace(id, set_);
+        return set_;
+    }
+    void FontCache::invalidate(const std::string_view path)
+    {
+        std::scoped_lock lock_(_lock);
+        _filedata.erase(std::string(path));
+        for (size_t idx = 0; idx < _source.size(); idx += 1)
+        {
+            if (_source[idx].path != path)
+            {
+                continue;
+            }
+            // face ids stay valid, the faces are opened again on the next lookup
+            const uint32_t id_ = static_cast<uint32_t>(idx + 1);
+            _charset.erase(id_);
+            for (auto& v : _context)
+            {
+                if (std::find(_idle.begin(), _idle.end(), v.get()) != _idle.end())
+                {
+                    v->removeFace(id_);
+                }
+                else
+                {
+                    _stale[v.get()].push_back(id_);
+                }
+            }
+        }
+    }
+    FontCache::Lease FontCache::acquire()
+    {
+        std::scoped_lock lock_(_lock);
+        if (!_idle.empty())
+        {
+            Context* context_ = _idle.back();
+            _idle.pop_back();
+            return Lease(this, context_);
+        }
+        auto context_ = std::make_unique<Context>(this);
+        if (!context_->valid())
+        {
+            return Lease(nullptr, nullptr);
+        }
+        _context.push_back(std::move(context_));
+        return Lease(this, _context.back().get());
+    }
+    
+    FontCache& FontCache::get()
+    {
+        static FontCache instance_;
+        return instance_;
+    }
+}
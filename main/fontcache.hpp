@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include "codeset.hpp"
+#include "ft2build.h"
+#include FT_FREETYPE_H
+#include FT_CACHE_H
+#include FT_MULTIPLE_MASTERS_H
+
+namespace fontatlas
+{
+    // process-wide freetype context, faces and sizes are cached across builds
+    class FontCache
+    {
+    public:
+        struct FaceSource
+        {
+            std::string path;
+            uint32_t face;
+            std::string instance; // named instance of a variable font, by style name
+            std::vector<std::pair<FT_ULong, float>> axis; // design coordinates by axis tag, applied after the instance
+        };
+        
+        class Context
+        {
+        private:
+            FT_Library _library = NULL;
+            FTC_Manager _manager = NULL;
+            FTC_CMapCache _cmap = NULL;
+        public:
+            bool valid();
+            FT_Library library();
+            FT_Face face(uint32_t id);
+            FT_Face size(uint32_t id, uint32_t size); // active size is set on the returned face
+            FT_UInt charIndex(uint32_t id, uint32_t code);
+            bool charset(uint32_t id, CodeSet& set); // enumerate the selected charmap
+            void removeFace(uint32_t id); // close the face and its sizes, it is opened again when needed
+        public:
+            Context(FontCache* cache);
+            Context(const Context&) = delete;
+            ~Context();
+        };
+        
+        class Lease
+        {
+        private:
+            FontCache* _cache = nullptr;
+            Context* _context = nullptr;
+        public:
+            Context* operator->() { return _context; }
+            Context& operator*() { return *_context; }
+            explicit operator bool() const { return _context != nullptr; }
+        public:
+            Lease(FontCache* cache, Context* context);
+            Lease(Lease&& right) noexcept;
+            Lease(const Lease&) = delete;
+            ~Lease();
+        };
+    private:
+        std::mutex _lock;
+        std::deque<FaceSource> _source; // face id - 1
+        std::vector<std::unique_ptr<Context>> _context;
+        std::vector<Context*> _idle;
+        std::unordered_map<Context*, std::vector<uint32_t>> _stale; // faces invalidated while leased, removed on release
+        std::unordered_map<uint32_t, std::shared_ptr<const CodeSet>> _charset;
+        std::unordered_map<std::string, std::shared_ptr<const std::vector<FT_Byte>>> _filedata;
+    private:
+        static FT_Error _requestFace(FTC_FaceID face_id, FT_Library library, FT_Pointer req_data, FT_Face* aface);
+        static FT_Error _openVariation(FT_Library library, const FaceSource& source,
+            const std::shared_ptr<const std::vector<FT_Byte>>& data, FT_Face* aface); // the face keeps data alive
+        static void _releaseFileData(void* object);
+        void _release(Context* context);
+    public:
+        uint32_t faceID(const std::string_view path, uint32_t face);
+        uint32_t faceID(const FaceSource& source); // instances of one file share the file data
+        FaceSource faceSource(uint32_t id);
+        std::shared_ptr<const std::vector<FT_Byte>> fileData(const std::string& path); // loaded once, kept alive
+        std::shared_ptr<const CodeSet> charset(uint32_t id);
+        void invalidate(const std::string_view path); // a font file changed on disk, leased contexts see it on release
+        Lease acquire();
+    public:
+        static FontCache& get();
+    };
+}
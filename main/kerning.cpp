@@ -0,0 +1,365 @@
+#include "kerning.hpp"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <utility>
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
+
+namespace fontatlas
+{
+    namespace
+    {
+        // big endian table access, reads outside of the table return 0
+        class TableReader
+        {
+        private:
+            std::vector<FT_Byte> _data;
+        public:
+            bool load(FT_Face face, FT_ULong tag)
+            {
+                FT_ULong length_ = 0;
+                if (FT_Load_Sfnt_Table(face, tag, 0, NULL, &length_) != FT_Err_Ok || length_ == 0)
+                {
+                    return false;
+                }
+                _data.resize(length_);
+                return FT_Load_Sfnt_Table(face, tag, 0, _data.data(), &length_) == FT_Err_Ok;
+            }
+            bool has(size_t offset, size_t count) const
+            {
+                return offset <= _data.size() && count <= _data.size() - offset;
+            }
+            uint16_t u16(size_t offset) const
+            {
+                return has(offset, 2) ? (uint16_t)((_data[offset] << 8) | _data[offset + 1]) : 0;
+            }
+            int16_t s16(size_t offset) const
+            {
+                return (int16_t)u16(offset);
+            }
+            uint32_t u32(size_t offset) const
+            {
+                return ((uint32_t)u16(offset) << 16) | u16(offset + 2);
+            }
+        };
+        
+        inline bool contains(const std::vector<uint32_t>& glyphs, uint32_t glyph)
+        {
+            return std::binary_search(glyphs.begin(), glyphs.end(), glyph);
+        }
+        
+        inline uint32_t valueRecordSize(uint16_t format)
+        {
+            uint32_t n = 0;
+            for (uint16_t bits = format & 0xFF; bits != 0; bits >>= 1)
+            {
+                n += bits & 1;
+            }
+            return n * 2;
+        }
+        
+        // XAdvance field of a value record, 0 if the format does not have it
+        inline int32_t valueRecordAdvance(const TableReader& t, size_t offset, uint16_t format)
+        {
+            if ((format & 0x0004) == 0)
+            {
+                return 0;
+            }
+            return t.s16(offset + ((format & 0x0001) ? 2 : 0) + ((format & 0x0002) ? 2 : 0));
+        }
+        
+        // call fn(glyph, coverage index) for the glyphs of the list inside the coverage table
+        template<typename F>
+        void forEachCoverage(const TableReader& t, size_t offset, const std::vector<uint32_t>& glyphs, F&& fn)
+        {
+            const uint16_t format_ = t.u16(offset);
+            if (format_ == 1)
+            {
+                const uint16_t count_ = t.u16(offset + 2);
+                for (uint32_t i = 0; i < count_ && t.has(offset + 4 + i * 2, 2); i += 1)
+                {
+                    const uint32_t glyph_ = t.u16(offset + 4 + i * 2);
+                    if (contains(glyphs, glyph_))
+                    {
+                        fn(glyph_, i);
+                    }
+                }
+            }
+            else if (format_ == 2)
+            {
+                const uint16_t count_ = t.u16(offset + 2);
+                for (uint32_t i = 0; i < count_ && t.has(offset + 4 + i * 6, 6); i += 1)
+                {
+                    const size_t range_ = offset + 4 + i * 6;
+                    const uint32_t start_ = t.u16(range_);
+                    const uint32_t end_ = t.u16(range_ + 2);
+                    const uint32_t index_ = t.u16(range_ + 4);
+                    auto it = std::lower_bound(glyphs.begin(), glyphs.end(), start_);
+                    for (; it != glyphs.end() && *it <= end_; ++it)
+                    {
+                        fn(*it, index_ + (*it - start_));
+                    }
+                }
+            }
+        }
+        
+        uint16_t classOf(const TableReader& t, size_t offset, uint32_t glyph)
+        {
+            const uint16_t format_ = t.u16(offset);
+            if (format_ == 1)
+            {
+                const uint32_t start_ = t.u16(offset + 2);
+                const uint32_t count_ = t.u16(offset + 4);
+                if (glyph >= start_ && glyph < start_ + count_)
+                {
+                    return t.u16(offset + 6 + (glyph - start_) * 2);
+                }
+            }
+            else if (format_ == 2)
+            {
+                // ranges are sorted by start glyph
+                uint32_t lo_ = 0;
+                uint32_t hi_ = t.u16(offset + 2);
+                while (lo_ < hi_)
+                {
+                    const uint32_t mid_ = (lo_ + hi_) / 2;
+                    const size_t range_ = offset + 4 + mid_ * 6;
+                    if (glyph < t.u16(range_))
+                    {
+                        hi_ = mid_;
+                    }
+                    else if (glyph > t.u16(range_ + 2))
+                    {
+                        lo_ = mid_ + 1;
+                    }
+                    else
+                    {
+                        return t.u16(range_ + 4);
+                    }
+                }
+            }
+            return 0;
+        }
+        
+        using PairKey = std::pair<uint32_t, uint32_t>;
+        
+        // one lookup, the first subtable which matches a pair wins
+        struct LookupState
+        {
+            std::set<PairKey> matched;          // pairs of format 1 subtables
+            std::unordered_set<uint32_t> closed; // first glyphs covered by format 2 subtables
+            bool applies(uint32_t first, uint32_t second) const
+            {
+                return closed.find(first) == closed.end() && matched.find(PairKey(first, second)) == matched.end();
+            }
+        };
+        
+        void loadPairPos(const TableReader& t, size_t offset, const std::vector<uint32_t>& glyphs,
+            LookupState& state, std::map<PairKey, int32_t>& values)
+        {
+            const uint16_t format_ = t.u16(offset);
+            const size_t coverage_ = offset + t.u16(offset + 2);
+            const uint16_t value_format1_ = t.u16(offset + 4);
+            const uint16_t value_format2_ = t.u16(offset + 6);
+            const uint32_t value_size1_ = valueRecordSize(value_format1_);
+            const uint32_t value_size2_ = valueRecordSize(value_format2_);
+            if (format_ == 1)
+            {
+                const uint16_t set_count_ = t.u16(offset + 8);
+                std::vector<PairKey> found_;
+                forEachCoverage(t, coverage_, glyphs, [&](uint32_t first, uint32_t index)
+                {
+                    if (index >= set_count_)
+                    {
+                        return;
+                    }
+                    const size_t set_ = offset + t.u16(offset + 10 + index * 2);
+                    const uint16_t count_ = t.u16(set_);
+                    const size_t record_size_ = 2 + value_size1_ + value_size2_;
+                    for (uint32_t i = 0; i < count_ && t.has(set_ + 2 + i * record_size_, record_size_); i += 1)
+                    {
+                        const size_t record_ = set_ + 2 + i * record_size_;
+                        const uint32_t second_ = t.u16(record_);
+                        if (!contains(glyphs, second_) || !state.applies(first, second_))
+                        {
+                            continue;
+                        }
+                        found_.emplace_back(first, second_);
+                        const int32_t value_ = valueRecordAdvance(t, record_ + 2, value_format1_);
+                        if (value_ != 0)
+                        {
+                            values[PairKey(first, second_)] += value_;
+                        }
+                    }
+                });
+                state.matched.insert(found_.begin(), found_.end());
+            }
+            else if (format_ == 2)
+            {
+                const size_t class_def1_ = offset + t.u16(offset + 8);
+                const size_t class_def2_ = offset + t.u16(offset + 10);
+                const uint16_t class1_count_ = t.u16(offset + 12);
+                const uint16_t class2_count_ = t.u16(offset + 14);
+                const size_t record_size_ = value_size1_ + value_size2_;
+                // second glyphs grouped by class
+                std::vector<std::vector<uint32_t>> bucket_(class2_count_);
+                for (uint32_t glyph : glyphs)
+                {
+                    const uint16_t c_ = classOf(t, class_def2_, glyph);
+                    if (c_ < class2_count_)
+                    {
+                        bucket_[c_].push_back(glyph);
+                    }
+                }
+                std::vector<uint32_t> found_;
+                forEachCoverage(t, coverage_, glyphs, [&](uint32_t first, uint32_t)
+                {
+                    const uint16_t c1_ = classOf(t, class_def1_, first);
+                    if (c1_ >= class1_count_ || state.closed.find(first) != state.closed.end())
+                    {
+                        return;
+                    }
+                    const size_t row_ = offset + 16 + (size_t)c1_ * class2_count_ * record_size_;
+                    for (uint32_t c2_ = 0; c2_ < class2_count_; c2_ += 1)
+                    {
+                        const int32_t value_ = valueRecordAdvance(t, row_ + c2_ * record_size_, value_format1_);
+                        if (value_ == 0)
+                        {
+                            continue;
+                        }
+                        for (uint32_t second : bucket_[c2_])
+                        {
+                            if (state.applies(first, second))
+                            {
+                                values[PairKey(first, second)] += value_;
+                            }
+                        }
+                    }
+                    found_.push_back(first);
+                });
+                state.closed.insert(found_.begin(), found_.end());
+            }
+        }
+        
+        bool loadGPOS(FT_Face face, const std::vector<uint32_t>& glyphs, std::map<PairKey, int32_t>& values)
+        {
+            TableReader t;
+            if (!t.load(face, TTAG_GPOS) || t.u16(0) != 1)
+            {
+                return false;
+            }
+            const size_t feature_list_ = t.u16(6);
+            const size_t lookup_list_ = t.u16(8);
+            // lookups of every 'kern' feature, all scripts
+            std::set<uint16_t> lookups_;
+            const uint16_t feature_count_ = t.u16(feature_list_);
+            for (uint32_t i = 0; i < feature_count_; i += 1)
+            {
+                const size_t record_ = feature_list_ + 2 + i * 6;
+                if (t.u32(record_) != TTAG_kern)
+                {
+                    continue;
+                }
+                const size_t feature_ = feature_list_ + t.u16(record_ + 4);
+                const uint16_t count_ = t.u16(feature_ + 2);
+                for (uint32_t j = 0; j < count_; j += 1)
+                {
+                    lookups_.insert(t.u16(feature_ + 4 + j * 2));
+                }
+            }
+            if (lookups_.empty())
+            {
+                return false;
+            }
+            const uint16_t lookup_count_ = t.u16(lookup_list_);
+            for (uint16_t index : lookups_)
+            {
+                if (index >= lookup_count_)
+                {
+                    continue;
+                }
+                const size_t lookup_ = lookup_list_ + t.u16(lookup_list_ + 2 + index * 2);
+                const uint16_t type_ = t.u16(lookup_);
+                const uint16_t subtable_count_ = t.u16(lookup_ + 4);
+                LookupState state_;
+                for (uint32_t i = 0; i < subtable_count_; i += 1)
+                {
+                    size_t subtable_ = lookup_ + t.u16(lookup_ + 6 + i * 2);
+                    uint16_t subtable_type_ = type_;
+                    if (type_ == 9)
+                    {
+                        // extension positioning
+                        subtable_type_ = t.u16(subtable_ + 2);
+                        subtable_ = subtable_ + t.u32(subtable_ + 4);
+                    }
+                    if (subtable_type_ == 2)
+                    {
+                        loadPairPos(t, subtable_, glyphs, state_, values);
+                    }
+                }
+            }
+            return true;
+        }
+        
+        bool loadKern(FT_Face face, const std::vector<uint32_t>& glyphs, std::map<PairKey, int32_t>& values)
+        {
+            TableReader t;
+            if (!t.load(face, TTAG_kern) || t.u16(0) != 0)
+            {
+                return false; // apple kern tables (version 1) are not read
+            }
+            const uint16_t count_ = t.u16(2);
+            size_t subtable_ = 4;
+            for (uint32_t i = 0; i < count_ && t.has(subtable_, 6); i += 1)
+            {
+                const uint16_t length_ = t.u16(subtable_ + 2);
+                const uint16_t coverage_ = t.u16(subtable_ + 4);
+                // format 0, horizontal, not minimum and not cross-stream
+                if ((coverage_ >> 8) == 0 && (coverage_ & 0x0007) == 0x0001)
+                {
+                    const uint16_t pair_count_ = t.u16(subtable_ + 6);
+                    const bool replace_ = (coverage_ & 0x0008) != 0;
+                    for (uint32_t j = 0; j < pair_count_ && t.has(subtable_ + 14 + j * 6, 6); j += 1)
+                    {
+                        const size_t pair_ = subtable_ + 14 + j * 6;
+                        const uint32_t first_ = t.u16(pair_);
+                        const uint32_t second_ = t.u16(pair_ + 2);
+                        if (contains(glyphs, first_) && contains(glyphs, second_))
+                        {
+                            int32_t& value_ = values[PairKey(first_, second_)];
+                            value_ = replace_ ? t.s16(pair_ + 4) : value_ + t.s16(pair_ + 4);
+                        }
+                    }
+                }
+                // the length field overflows for large format 0 subtables, which are always the last one
+                subtable_ += std::max<uint16_t>(length_, 6);
+            }
+            return true;
+        }
+    }
+    
+    bool loadKerningPairs(FT_Face face, const std::vector<uint32_t>& glyphs, std::vector<KerningPair>& pairs)
+    {
+        pairs.clear();
+        if (face == NULL || !FT_IS_SFNT(face))
+        {
+            return false;
+        }
+        std::map<PairKey, int32_t> values_;
+        if (!loadGPOS(face, glyphs, values_) && !loadKern(face, glyphs, values_))
+        {
+            return false;
+        }
+        pairs.reserve(values_.size());
+        for (auto& v : values_)
+        {
+            if (v.second != 0)
+            {
+                pairs.push_back(KerningPair{ v.first.first, v.first.second, v.second });
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "ft2build.h"
+#include FT_FREETYPE_H
+
+namespace fontatlas
+{
+    struct KerningPair
+    {
+        uint32_t first;  // glyph index
+        uint32_t second; // glyph index
+        int32_t value;   // horizontal advance adjustment in font units
+    };
+    
+    // horizontal kerning between glyphs of the sorted list, sorted by first then second,
+    // read from the GPOS 'kern' feature (pair adjustment) or the legacy kern table if there is none
+    bool loadKerningPairs(FT_Face face, const std::vector<uint32_t>& glyphs, std::vector<KerningPair>& pairs);
+}
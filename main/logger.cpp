@@ -3,6 +3,16 @@
 #include <cstdarg>
 #include <cstring>
 #include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#define  WIN32_LEAN_AND_MEAN
+#define  NOMINMAX
 #include <Windows.h>
 
 namespace
@@ -14,8 +24,141 @@ namespace
         "[E] ",
         "[F] ",
     };
+    
+    constexpr size_t _ring_size = 1024 * 1024;
+    constexpr uint32_t _default_interval_ms = 200;
+    constexpr size_t _default_flush_size = 64 * 1024;
 };
 
+// log text is queued in a ring buffer and written by a drain thread in batches
+struct logger::backend
+{
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::vector<char> ring = std::vector<char>(_ring_size);
+    size_t head = 0;
+    size_t used = 0;
+    uint64_t pushed = 0;
+    uint64_t written = 0;
+    uint32_t interval_ms = _default_interval_ms;
+    size_t flush_size = _default_flush_size;
+    bool request = false;
+    bool stop = false;
+    bool oversized = false; // a message larger than the ring is being copied in parts
+    std::atomic<int> min_level{ 0 };
+    std::thread thread;
+};
+
+void logger::_push(const char* head, size_t head_len, const char* str, size_t len, bool sync) noexcept
+{
+    backend& b = *_backend;
+    std::unique_lock<std::mutex> lock_(b.lock);
+    // wait for the drain thread to make room, the lock is released while waiting
+    auto wait_ = [&](size_t size, bool exclusive)
+    {
+        while (b.ring.size() - b.used < size || (b.oversized && !exclusive))
+        {
+            b.wake.notify_one();
+            b.drained.wait(lock_);
+        }
+    };
+    // room for size bytes is already there
+    auto copy_ = [&](const char* data, size_t size)
+    {
+        while (size > 0)
+        {
+            const size_t tail_ = (b.head + b.used) % b.ring.size();
+            const size_t n = std::min(size, b.ring.size() - tail_);
+            std::memcpy(b.ring.data() + tail_, data, n);
+            b.used += n;
+            b.pushed += n;
+            data += n;
+            size -= n;
+        }
+    };
+    // a message is copied in one go so other threads can not write into it, only one larger than the
+    // ring is split and the other threads wait until its last part is queued
+    if (head_len + len <= b.ring.size())
+    {
+        wait_(head_len + len, false);
+        copy_(head, head_len);
+        copy_(str, len);
+    }
+    else
+    {
+        wait_(0, false);
+        b.oversized = true;
+        wait_(head_len, true);
+        copy_(head, head_len);
+        while (len > 0)
+        {
+            wait_(1, true);
+            const size_t n = std::min(len, b.ring.size() - b.used);
+            copy_(str, n);
+            str += n;
+            len -= n;
+        }
+        b.oversized = false;
+        b.drained.notify_all();
+    }
+    if (sync)
+    {
+        const uint64_t target_ = b.pushed;
+        b.request = true;
+        b.wake.notify_one();
+        b.drained.wait(lock_, [&]() { return b.written >= target_ || b.stop; });
+    }
+    else if (b.used >= b.flush_size)
+    {
+        b.wake.notify_one();
+    }
+}
+void logger::_drain() noexcept
+{
+    backend& b = *_backend;
+    std::string chunk_;
+    std::unique_lock<std::mutex> lock_(b.lock);
+    while (true)
+    {
+        b.wake.wait_for(lock_, std::chrono::milliseconds(b.interval_ms), [&]()
+        {
+            return b.stop || b.request || b.used >= b.flush_size;
+        });
+        const size_t n = b.used;
+        if (n > 0)
+        {
+            const size_t first_ = std::min(n, b.ring.size() - b.head);
+            chunk_.assign(b.ring.data() + b.head, first_);
+            chunk_.append(b.ring.data(), n - first_);
+            b.head = (b.head + n) % b.ring.size();
+            b.used = 0;
+        }
+        b.request = false;
+        const bool stop_ = b.stop;
+        lock_.unlock();
+        b.drained.notify_all();
+        if (n > 0)
+        {
+            // one debug output, one write and one flush per batch
+            OutputDebugStringA(chunk_.c_str());
+            if (_file != static_cast<void*>(INVALID_HANDLE_VALUE))
+            {
+                DWORD cnt_ = 0;
+                WriteFile(static_cast<HANDLE>(_file), chunk_.data(), 0xFFFFFFFF & chunk_.size(), &cnt_, nullptr);
+                FlushFileBuffers(static_cast<HANDLE>(_file));
+            }
+        }
+        lock_.lock();
+        b.written += n;
+        b.drained.notify_all();
+        if (stop_ && b.used == 0)
+        {
+            break;
+        }
+    }
+}
+
 void logger::write(const char* str) noexcept
 {
     return write(str, std::strlen(str));
@@ -27,13 +170,7 @@ void logger::write(const char* str, size_t len) noexcept
         return;
     }
     assert(str != nullptr || len == 0);
-    OutputDebugStringA(str);
-    if (_file != static_cast<void*>(INVALID_HANDLE_VALUE))
-    {
-        DWORD cnt_ = 0;
-        WriteFile(static_cast<HANDLE>(_file), str, 0xFFFFFFFF & len, &cnt_, nullptr);
-        FlushFileBuffers(static_cast<HANDLE>(_file));
-    }
+    _push(nullptr, 0, str, len, false);
 }
 void logger::writef(const char* fmt, ...) noexcept
 {
@@ -74,21 +211,13 @@ void logger::log(level lv, const char* str) noexcept
 }
 void logger::log(level lv, const char* str, size_t len) noexcept
 {
-    if (len == 0)
+    if (len == 0 || lv < getLevel())
     {
         return;
     }
     assert(static_cast<int>(lv) >= 0 && static_cast<int>(lv) <= 5);
     assert(str != nullptr || len == 0);
-    OutputDebugStringA(_level_head[static_cast<int>(lv)]);
-    OutputDebugStringA(str);
-    if (_file != static_cast<void*>(INVALID_HANDLE_VALUE))
-    {
-        DWORD cnt_ = 0;
-        WriteFile(static_cast<HANDLE>(_file), _level_head[static_cast<int>(lv)], 4, &cnt_, nullptr);
-        WriteFile(static_cast<HANDLE>(_file), str, 0xFFFFFFFF & len, &cnt_, nullptr);
-        FlushFileBuffers(static_cast<HANDLE>(_file));
-    }
+    _push(_level_head[static_cast<int>(lv)], 4, str, len, lv == level::fatal);
 }
 void logger::logf(level lv, const char* fmt, ...) noexcept
 {
@@ -99,6 +228,10 @@ void logger::logf(level lv, const char* fmt, ...) noexcept
 }
 void logger::logfv(level lv, const char* fmt, void* arg) noexcept
 {
+    if (lv < getLevel())
+    {
+        return;
+    }
     const int size_ = std::vsnprintf(nullptr, 0, fmt, static_cast<va_list>(arg));
     if (size_ > 0 && size_ < 64)
     {
@@ -123,6 +256,32 @@ void logger::logfv(level lv, const char* fmt, void* arg) noexcept
     }
     // else ???
 }
+void logger::setLevel(level lv) noexcept
+{
+    _backend->min_level.store(static_cast<int>(lv));
+}
+logger::level logger::getLevel() const noexcept
+{
+    return static_cast<level>(_backend->min_level.load());
+}
+void logger::setFlushPolicy(uint32_t interval_ms, size_t size) noexcept
+{
+    {
+        std::scoped_lock<std::mutex> lock_(_backend->lock);
+        _backend->interval_ms = std::max<uint32_t>(interval_ms, 1);
+        _backend->flush_size = std::clamp<size_t>(size, 1, _backend->ring.size());
+    }
+    _backend->wake.notify_one();
+}
+void logger::flush() noexcept
+{
+    backend& b = *_backend;
+    std::unique_lock<std::mutex> lock_(b.lock);
+    const uint64_t target_ = b.pushed;
+    b.request = true;
+    b.wake.notify_one();
+    b.drained.wait(lock_, [&]() { return b.written >= target_ || b.stop; });
+}
 
 void logger::debug(const char* fmt, ...) noexcept
 {
@@ -175,13 +334,26 @@ logger::logger() : _file(static_cast<void*>(INVALID_HANDLE_VALUE))
     {
         _file = static_cast<void*>(file_h_);
     }
-    else
+    _backend = new backend;
+    _backend->thread = std::thread(&logger::_drain, this);
+    if (_file == static_cast<void*>(INVALID_HANDLE_VALUE))
     {
         log(level::error, "create file \"build.log\" failed");
     }
 }
 logger::~logger()
 {
+    {
+        std::scoped_lock<std::mutex> lock_(_backend->lock);
+        _backend->stop = true;
+    }
+    _backend->wake.notify_one();
+    if (_backend->thread.joinable())
+    {
+        _backend->thread.join();
+    }
+    delete _backend;
+    _backend = nullptr;
     if (_file != static_cast<void*>(INVALID_HANDLE_VALUE))
     {
         CloseHandle(static_cast<HANDLE>(_file));
@@ -1,9 +1,13 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 
 class logger
 {
 private:
+    struct backend;
     void* _file = nullptr;
+    backend* _backend = nullptr;
 public:
     enum class level
     {
@@ -13,6 +17,9 @@ public:
         error = 3,
         fatal = 4,
     };
+private:
+    void _push(const char* head, size_t head_len, const char* str, size_t len, bool sync) noexcept;
+    void _drain() noexcept;
 public:
     void write(const char* str) noexcept;
     void write(const char* str, size_t len) noexcept;
@@ -22,6 +29,10 @@ public:
     void log(level lv, const char* str, size_t len) noexcept;
     void logf(level lv, const char* fmt, ...) noexcept;
     void logfv(level lv, const char* fmt, void* arg) noexcept;
+    void setLevel(level lv) noexcept;
+    level getLevel() const noexcept;
+    void setFlushPolicy(uint32_t interval_ms, size_t size) noexcept; // drain after interval or once size bytes are queued
+    void flush() noexcept; // block until all queued text is written
 public:
     static void debug(const char* fmt, ...) noexcept;
     static void info(const char* fmt, ...) noexcept;
@@ -1,22 +1,328 @@
 #include "common.hpp"
 #include "builder.hpp"
 #include "binding.hpp"
+#include "fontcache.hpp"
 #include "lua.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+#include <unordered_map>
 
-int main(int, char**)
+// fontatlas                          run config.lua from the working directory
+// fontatlas <config.lua> ...         run several configs in one process
+// fontatlas --manifest <list.lua>    run the configs listed by list.lua, it returns a table of paths
+//                                    relative to its own directory
+// --jobs <n>                         configs run at the same time, all hardware threads by default
+// --watch <config.lua>               build, then rebuild whenever the config, a file it reads or a font changes,
+//                                    builds are incremental and fonts stay loaded between them
+// --stamp <file>                     with --watch, written after every successful build with an increasing
+//                                    generation number, fontatlas.stamp by default
+//
+// a config fails when it raises an error or any builder:build or buildAsync in it returns false,
+// the exit code is 1 when a config failed
+//
+// configs share the font cache, so a font used by several atlases is opened and parsed once,
+// paths inside a config stay relative to the working directory
+
+namespace
 {
-    fontatlas::ScopeCoInitialize co;
+    // a config fails when it raises an error or any of its builds returns false,
+    // configs usually ignore the result of builder:build
+    bool checkBuilds(const std::string& path, const std::atomic<uint32_t>& failed)
+    {
+        if (failed.load() > 0)
+        {
+            std::printf("%s: %u builds failed\n", path.c_str(), failed.load());
+            return false;
+        }
+        return true;
+    }
     
-    lua_State* L = luaL_newstate();
-    if (L)
+    bool runConfig(const std::string& path)
     {
+        fontatlas::ScopeCoInitialize co;
+        lua_State* L = luaL_newstate();
+        if (!L)
+        {
+            return false;
+        }
+        std::atomic<uint32_t> failed_{ 0 };
         luaL_openlibs(L);
         fontatlas::lua_fontatlas_open(L);
+        fontatlas::lua_fontatlas_count_failures(L, &failed_);
         lua_settop(L, 0);
-        fontatlas::lua_safe_dofile(L, "config.lua");
+        const bool ret = fontatlas::lua_safe_dofile(L, path);
+        // waits for builds still running from buildAsync
         lua_close(L);
-        L = NULL;
+        return checkBuilds(path, failed_) && ret;
     }
     
-    return 0;
+    // run before a watched config: records the files it reads and the fonts it adds,
+    // every builder keeps its layout so the next build only adds new code points
+    constexpr char watch_prelude_[] =
+        "local watch_file, watch_font = ...\n"
+        "local open, lines, dofile_, loadfile_ = io.open, io.lines, dofile, loadfile\n"
+        "io.open = function(path, mode, ...)\n"
+        "  if mode == nil or string.find(mode, 'r', 1, true) then watch_file(path) end\n"
+        "  return open(path, mode, ...)\n"
+        "end\n"
+        "io.lines = function(path, ...) if path ~= nil then watch_file(path) end return lines(path, ...) end\n"
+        "dofile = function(path, ...) if path ~= nil then watch_file(path) end return dofile_(path, ...) end\n"
+        "loadfile = function(path, ...) if path ~= nil then watch_file(path) end return loadfile_(path, ...) end\n"
+        "local create = fontatlas.Builder\n"
+        "local cls = getmetatable(create()).__index\n"
+        "local addFont = cls.addFont\n"
+        "cls.addFont = function(self, name, path, ...) watch_font(path) return addFont(self, name, path, ...) end\n"
+        "fontatlas.Builder = function() local builder = create() builder:setIncremental(true) return builder end\n";
+    
+    int watchRecord(lua_State* L)
+    {
+        auto* list_ = static_cast<std::vector<std::string>*>(lua_touserdata(L, lua_upvalueindex(1)));
+        if (lua_type(L, 1) == LUA_TSTRING)
+        {
+            list_->emplace_back(lua_tostring(L, 1));
+        }
+        return 0;
+    }
+    
+    bool runWatchedConfig(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& fonts)
+    {
+        fontatlas::ScopeCoInitialize co;
+        lua_State* L = luaL_newstate();
+        if (!L)
+        {
+            return false;
+        }
+        std::atomic<uint32_t> failed_{ 0 };
+        luaL_openlibs(L);
+        fontatlas::lua_fontatlas_open(L);
+        fontatlas::lua_fontatlas_count_failures(L, &failed_);
+        lua_settop(L, 0);
+        bool ret = luaL_loadbuffer(L, watch_prelude_, sizeof(watch_prelude_) - 1, "=watch") == LUA_OK;
+        if (ret)
+        {
+            lua_pushlightuserdata(L, &files);
+            lua_pushcclosure(L, &watchRecord, 1);
+            lua_pushlightuserdata(L, &fonts);
+            lua_pushcclosure(L, &watchRecord, 1);
+            ret = lua_pcall(L, 2, 0, 0) == LUA_OK;
+        }
+        if (!ret)
+        {
+            std::printf("%s\n", lua_tostring(L, -1));
+        }
+        ret = ret && fontatlas::lua_safe_dofile(L, path);
+        lua_close(L);
+        return checkBuilds(path, failed_) && ret;
+    }
+    
+    int watchConfig(const std::string& config, const std::string& stamp)
+    {
+        using clock_ = std::chrono::steady_clock;
+        using file_time_ = std::filesystem::file_time_type;
+        auto write_time_ = [](const std::string& path)
+        {
+            std::error_code ec_;
+            const file_time_ time_ = std::filesystem::last_write_time(fontatlas::toWide(path), ec_);
+            return ec_ ? file_time_::min() : time_;
+        };
+        std::vector<std::string> files_;
+        std::vector<std::string> fonts_;
+        std::unordered_map<std::string, file_time_> time_;
+        uint32_t generation_ = 0;
+        auto rebuild_ = [&]()
+        {
+            // times are taken before the build, a file saved while it runs triggers the next one
+            std::unordered_map<std::string, file_time_> before_;
+            for (auto& it : time_)
+            {
+                before_[it.first] = write_time_(it.first);
+            }
+            before_[config] = write_time_(config);
+            time_.clear();
+            files_.clear();
+            fonts_.clear();
+            const clock_::time_point begin_ = clock_::now();
+            const bool ok_ = runWatchedConfig(config, files_, fonts_);
+            const double ms_ = std::chrono::duration<double, std::milli>(clock_::now() - begin_).count();
+            files_.push_back(config);
+            for (auto* list : { &files_, &fonts_ })
+            {
+                for (auto& v : *list)
+                {
+                    auto it = before_.find(v);
+                    time_[v] = it != before_.end() ? it->second : write_time_(v);
+                }
+            }
+            if (!ok_)
+            {
+                std::printf("%s: failed, waiting for the next change\n", config.c_str());
+                return;
+            }
+            // the generation is replaced in one step, a reader never sees a partial number
+            generation_ += 1;
+            const std::string temp_ = stamp + ".tmp";
+            {
+                std::ofstream file_(fontatlas::toWide(temp_), std::ios::binary | std::ios::out | std::ios::trunc);
+                file_ << generation_ << "\n";
+            }
+            if (!fontatlas::replaceFile(fontatlas::toWide(temp_), fontatlas::toWide(stamp)))
+            {
+                std::printf("can not write %s\n", stamp.c_str());
+            }
+            std::printf("%s: built in %.0f ms, generation %u, watching %u files\n",
+                config.c_str(), ms_, generation_, (uint32_t)time_.size());
+            std::fflush(stdout);
+        };
+        rebuild_();
+        for (;;)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            std::vector<std::string> changed_;
+            for (auto& it : time_)
+            {
+                if (write_time_(it.first) != it.second)
+                {
+                    changed_.push_back(it.first);
+                }
+            }
+            if (changed_.empty())
+            {
+                continue;
+            }
+            // editors often save in several writes
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            for (auto& v : changed_)
+            {
+                if (std::find(fonts_.begin(), fonts_.end(), v) != fonts_.end())
+                {
+                    fontatlas::FontCache::get().invalidate(v);
+                }
+                std::printf("changed: %s\n", v.c_str());
+            }
+            rebuild_();
+        }
+        return 0;
+    }
+    
+    bool readManifest(const std::string& path, std::vector<std::string>& list)
+    {
+        lua_State* L = luaL_newstate();
+        if (!L)
+        {
+            return false;
+        }
+        luaL_openlibs(L);
+        bool ret = fontatlas::lua_safe_dofile(L, path, 1);
+        if (ret && lua_istable(L, -1))
+        {
+            const std::filesystem::path base_ = std::filesystem::path(fontatlas::toWide(path)).parent_path();
+            const lua_Integer n = (lua_Integer)lua_rawlen(L, -1);
+            for (lua_Integer i = 1; i <= n; i += 1)
+            {
+                lua_rawgeti(L, -1, i);
+                if (lua_type(L, -1) == LUA_TSTRING)
+                {
+                    const std::filesystem::path entry_(fontatlas::toWide(lua_tostring(L, -1)));
+                    list.push_back(fontatlas::toUTF8((entry_.is_absolute() ? entry_ : base_ / entry_).wstring()));
+                }
+                lua_pop(L, 1);
+            }
+        }
+        else if (ret)
+        {
+            std::printf("%s: a manifest returns a table of config paths\n", path.c_str());
+            ret = false;
+        }
+        lua_close(L);
+        return ret;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    fontatlas::ScopeCoInitialize co;
+    
+    std::vector<std::string> config_;
+    bool listed_ = false;
+    std::string watch_;
+    std::string stamp_ = "fontatlas.stamp";
+    uint32_t jobs_ = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; i += 1)
+    {
+        if (std::strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+        {
+            jobs_ = std::max((uint32_t)std::strtoul(argv[++i], nullptr, 10), 1u);
+        }
+        else if (std::strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+        {
+            watch_ = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--stamp") == 0 && i + 1 < argc)
+        {
+            stamp_ = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--manifest") == 0 && i + 1 < argc)
+        {
+            if (!readManifest(argv[++i], config_))
+            {
+                return 1;
+            }
+            listed_ = true;
+        }
+        else
+        {
+            config_.emplace_back(argv[i]);
+            listed_ = true;
+        }
+    }
+    if (!watch_.empty())
+    {
+        return watchConfig(watch_, stamp_);
+    }
+    if (!listed_)
+    {
+        config_.emplace_back("config.lua");
+    }
+    if (config_.size() <= 1)
+    {
+        return (config_.empty() || runConfig(config_[0])) ? 0 : 1;
+    }
+    
+    // one lua state per config, workers take the next config when they are done
+    std::atomic<size_t> next_{ 0 };
+    std::atomic<uint32_t> failed_{ 0 };
+    auto work_ = [&]()
+    {
+        for (size_t i = next_.fetch_add(1); i < config_.size(); i = next_.fetch_add(1))
+        {
+            const bool ok_ = runConfig(config_[i]);
+            std::printf("%s: %s\n", config_[i].c_str(), ok_ ? "done" : "failed");
+            if (!ok_)
+            {
+                failed_.fetch_add(1);
+            }
+        }
+    };
+    std::vector<std::thread> thread_;
+    const size_t workers_ = std::min<size_t>(jobs_, config_.size());
+    for (size_t i = 1; i < workers_; i += 1)
+    {
+        thread_.emplace_back(work_);
+    }
+    work_();
+    for (auto& t : thread_)
+    {
+        t.join();
+    }
+    std::printf("%u of %u configs built\n", (uint32_t)config_.size() - failed_.load(), (uint32_t)config_.size());
+    return failed_.load() == 0 ? 0 : 1;
 }
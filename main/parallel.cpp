@@ -0,0 +1,95 @@
+#include "parallel.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+namespace fontatlas
+{
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn)
+    {
+        const size_t workers_ = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+        if (workers_ <= 1)
+        {
+            for (size_t i = 0; i < count; i += 1)
+            {
+                fn(i);
+            }
+            return;
+        }
+        std::atomic<size_t> next_{ 0 };
+        auto work_ = [&]()
+        {
+            for (size_t i = next_.fetch_add(1); i < count; i = next_.fetch_add(1))
+            {
+                fn(i);
+            }
+        };
+        std::vector<std::thread> thread_;
+        thread_.reserve(workers_ - 1);
+        for (size_t i = 1; i < workers_; i += 1)
+        {
+            thread_.emplace_back(work_);
+        }
+        work_();
+        for (auto& t : thread_)
+        {
+            t.join();
+        }
+    }
+    
+    void TaskPool::_run()
+    {
+        while (true)
+        {
+            std::function<void()> task_;
+            {
+                std::unique_lock lock_(_lock);
+                _wake.wait(lock_, [&]() { return _stop || !_task.empty(); });
+                if (_task.empty())
+                {
+                    return;
+                }
+                task_ = std::move(_task.front());
+                _task.pop_front();
+            }
+            task_();
+        }
+    }
+    void TaskPool::submit(std::function<void()> task)
+    {
+        {
+            std::scoped_lock lock_(_lock);
+            _task.push_back(std::move(task));
+        }
+        _wake.notify_one();
+    }
+    
+    TaskPool::TaskPool(size_t threads)
+    {
+        threads = std::max<size_t>(threads, 1);
+        _thread.reserve(threads);
+        for (size_t i = 0; i < threads; i += 1)
+        {
+            _thread.emplace_back([this]() { _run(); });
+        }
+    }
+    TaskPool::~TaskPool()
+    {
+        {
+            std::scoped_lock lock_(_lock);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (auto& t : _thread)
+        {
+            t.join();
+        }
+    }
+    
+    TaskPool& TaskPool::get()
+    {
+        static TaskPool instance_(std::thread::hardware_concurrency());
+        return instance_;
+    }
+}
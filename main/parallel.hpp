@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace fontatlas
+{
+    // run fn(i) for every i in [0, count) on all hardware threads, returns when all are done
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn);
+    
+    // long lived threads running queued tasks in order, for work that outlives the caller,
+    // like a whole build started from lua
+    class TaskPool
+    {
+    private:
+        std::mutex _lock;
+        std::condition_variable _wake;
+        std::deque<std::function<void()>> _task;
+        std::vector<std::thread> _thread;
+        bool _stop = false;
+    private:
+        void _run();
+    public:
+        void submit(std::function<void()> task);
+    public:
+        TaskPool(size_t threads);
+        TaskPool(const TaskPool&) = delete;
+        ~TaskPool(); // queued tasks still run
+    public:
+        static TaskPool& get(); // one thread per hardware thread, builds parallelize inside too
+    };
+}
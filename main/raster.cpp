@@ -0,0 +1,814 @@
+#include "raster.hpp"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include FT_OUTLINE_H
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define FONTATLAS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace fontatlas
+{
+    constexpr uint32_t color_black = 0;
+    constexpr uint32_t color_red = 1;
+    constexpr uint32_t color_green = 2;
+    constexpr uint32_t color_yellow = 3;
+    constexpr uint32_t color_blue = 4;
+    constexpr uint32_t color_magenta = 5;
+    constexpr uint32_t color_cyan = 6;
+    constexpr uint32_t color_white = 7;
+    
+    constexpr uint32_t conic_segments = 8;
+    constexpr uint32_t cubic_segments = 12;
+    constexpr float corner_cross_threshold = 0.14112f; // sin(3 rad), same as msdfgen
+    constexpr float distance_infinity = 1e20f;
+    
+    inline float toPixel(FT_Pos v) { return (float)v / 64.0f; }
+    
+    inline uint8_t encodeDistance(float d, uint32_t spread)
+    {
+        const float v = 127.5f + 127.5f * d / (float)spread;
+        return (uint8_t)std::clamp(v + 0.5f, 0.0f, 255.0f);
+    }
+    
+    bool copyGlyphImage(FT_GlyphSlot glyph, uint32_t padding, GlyphImage& image)
+    {
+        const FT_Bitmap& bitmap = glyph->bitmap;
+        if (bitmap.pixel_mode != FT_PIXEL_MODE_GRAY || bitmap.num_grays != 256)
+        {
+            return false;
+        }
+        image.width = bitmap.width + 2 * padding;
+        image.height = bitmap.rows + 2 * padding;
+        image.channels = 1;
+        image.padding = padding;
+        image.pixels.assign((size_t)image.width * image.height, 0);
+        const uint8_t* src = bitmap.buffer;
+        for (uint32_t y = 0; y < bitmap.rows; y += 1)
+        {
+            std::memcpy(image.row(y + padding) + padding, src, bitmap.width);
+            src += bitmap.pitch;
+        }
+        image.metrics_width = toPixel(glyph->metrics.width);
+        image.metrics_height = toPixel(glyph->metrics.height);
+        image.h_bearing_x = toPixel(glyph->metrics.horiBearingX);
+        image.h_bearing_y = toPixel(glyph->metrics.horiBearingY);
+        image.h_advance = toPixel(glyph->metrics.horiAdvance);
+        image.v_bearing_x = toPixel(glyph->metrics.vertBearingX);
+        image.v_bearing_y = toPixel(glyph->metrics.vertBearingY);
+        image.v_advance = toPixel(glyph->metrics.vertAdvance);
+        image.bitmap_left = glyph->bitmap_left;
+        image.bitmap_top = glyph->bitmap_top;
+        return true;
+    }
+    
+    bool renderGlyphOutline(FT_Library library, FT_OutlineGlyph glyph, const FT_Glyph_Metrics& metrics, FT_Fixed scale,
+        uint32_t padding, GlyphImage& image)
+    {
+        FT_Outline* outline = &glyph->outline;
+        // pixel aligned control box, the same rectangle FT_Render_Glyph uses
+        FT_BBox cbox_ = {};
+        FT_Outline_Get_CBox(outline, &cbox_);
+        const FT_Pos x_min = cbox_.xMin & ~63;
+        const FT_Pos y_min = cbox_.yMin & ~63;
+        const FT_Pos x_max = (cbox_.xMax + 63) & ~63;
+        const FT_Pos y_max = (cbox_.yMax + 63) & ~63;
+        const uint32_t width = (uint32_t)((x_max - x_min) >> 6);
+        const uint32_t rows = (uint32_t)((y_max - y_min) >> 6);
+        image.width = width + 2 * padding;
+        image.height = rows + 2 * padding;
+        image.channels = 1;
+        image.padding = padding;
+        image.pixels.assign((size_t)image.width * image.height, 0);
+        if (width > 0 && rows > 0)
+        {
+            // render straight into the padded image, the outline is moved to the origin and back
+            FT_Bitmap bitmap_ = {};
+            bitmap_.rows = rows;
+            bitmap_.width = width;
+            bitmap_.pitch = (int)image.width;
+            bitmap_.buffer = image.row(padding) + padding;
+            bitmap_.num_grays = 256;
+            bitmap_.pixel_mode = FT_PIXEL_MODE_GRAY;
+            FT_Outline_Translate(outline, -x_min, -y_min);
+            const FT_Error fterr_ = FT_Outline_Get_Bitmap(library, outline, &bitmap_);
+            FT_Outline_Translate(outline, x_min, y_min);
+            if (fterr_ != FT_Err_Ok)
+            {
+                return false;
+            }
+        }
+        // unhinted bearings are fractional, snap them to the bitmap so the quad matches the pixels
+        auto scaled_ = [&](FT_Pos v) { return toPixel(FT_MulFix(v, scale)); };
+        image.bitmap_left = (int32_t)(x_min >> 6);
+        image.bitmap_top = (int32_t)(y_max >> 6);
+        const float dx = (float)image.bitmap_left - scaled_(metrics.horiBearingX);
+        const float dy = (float)image.bitmap_top - scaled_(metrics.horiBearingY);
+        image.metrics_width = (float)width;
+        image.metrics_height = (float)rows;
+        image.h_bearing_x = (float)image.bitmap_left;
+        image.h_bearing_y = (float)image.bitmap_top;
+        image.h_advance = scaled_(metrics.horiAdvance);
+        image.v_bearing_x = scaled_(metrics.vertBearingX) + dx;
+        image.v_bearing_y = scaled_(metrics.vertBearingY) + dy;
+        image.v_advance = scaled_(metrics.vertAdvance);
+        return true;
+    }
+    
+    // shape
+    
+    namespace
+    {
+        struct ShapeBuilder
+        {
+            GlyphShape* shape;
+            GlyphShape::Point last;
+            
+            void beginEdge()
+            {
+                shape->edges.push_back(GlyphShape::Edge{ (uint32_t)shape->points.size(), 1, color_white });
+                shape->points.push_back(last);
+                shape->contours.back().count += 1;
+            }
+            void point(float x, float y)
+            {
+                last = GlyphShape::Point{ x, y };
+                shape->points.push_back(last);
+                shape->edges.back().count += 1;
+            }
+            
+            static int moveTo(const FT_Vector* to, void* user)
+            {
+                ShapeBuilder* self = static_cast<ShapeBuilder*>(user);
+                self->shape->contours.push_back(GlyphShape::Contour{ (uint32_t)self->shape->edges.size(), 0 });
+                self->last = GlyphShape::Point{ toPixel(to->x), toPixel(to->y) };
+                return 0;
+            }
+            static int lineTo(const FT_Vector* to, void* user)
+            {
+                ShapeBuilder* self = static_cast<ShapeBuilder*>(user);
+                const GlyphShape::Point p = { toPixel(to->x), toPixel(to->y) };
+                if (p.x == self->last.x && p.y == self->last.y)
+                {
+                    return 0; // degenerate
+                }
+                self->beginEdge();
+                self->point(p.x, p.y);
+                return 0;
+            }
+            static int conicTo(const FT_Vector* control, const FT_Vector* to, void* user)
+            {
+                ShapeBuilder* self = static_cast<ShapeBuilder*>(user);
+                const GlyphShape::Point p0 = self->last;
+                const GlyphShape::Point p1 = { toPixel(control->x), toPixel(control->y) };
+                const GlyphShape::Point p2 = { toPixel(to->x), toPixel(to->y) };
+                self->beginEdge();
+                for (uint32_t i = 1; i <= conic_segments; i += 1)
+                {
+                    const float t = (float)i / (float)conic_segments;
+                    const float u = 1.0f - t;
+                    self->point(
+                        u * u * p0.x + 2.0f * u * t * p1.x + t * t * p2.x,
+                        u * u * p0.y + 2.0f * u * t * p1.y + t * t * p2.y);
+                }
+                return 0;
+            }
+            static int cubicTo(const FT_Vector* control1, const FT_Vector* control2, const FT_Vector* to, void* user)
+            {
+                ShapeBuilder* self = static_cast<ShapeBuilder*>(user);
+                const GlyphShape::Point p0 = self->last;
+                const GlyphShape::Point p1 = { toPixel(control1->x), toPixel(control1->y) };
+                const GlyphShape::Point p2 = { toPixel(control2->x), toPixel(control2->y) };
+                const GlyphShape::Point p3 = { toPixel(to->x), toPixel(to->y) };
+                self->beginEdge();
+                for (uint32_t i = 1; i <= cubic_segments; i += 1)
+                {
+                    const float t = (float)i / (float)cubic_segments;
+                    const float u = 1.0f - t;
+                    self->point(
+                        u * u * u * p0.x + 3.0f * u * u * t * p1.x + 3.0f * u * t * t * p2.x + t * t * t * p3.x,
+                        u * u * u * p0.y + 3.0f * u * u * t * p1.y + 3.0f * u * t * t * p2.y + t * t * t * p3.y);
+                }
+                return 0;
+            }
+        };
+        
+        inline GlyphShape::Point direction(const GlyphShape::Point& a, const GlyphShape::Point& b)
+        {
+            const float dx = b.x - a.x;
+            const float dy = b.y - a.y;
+            const float len = std::sqrt(dx * dx + dy * dy);
+            if (len <= 0.0f)
+            {
+                return GlyphShape::Point{ 0.0f, 0.0f };
+            }
+            return GlyphShape::Point{ dx / len, dy / len };
+        }
+        
+        // same color switching rule as msdfgen edgeColoringSimple, with a fixed seed
+        void switchColor(uint32_t& color, uint32_t banned)
+        {
+            const uint32_t combined = color & banned;
+            if (combined == color_red || combined == color_green || combined == color_blue)
+            {
+                color = combined ^ color_white;
+                return;
+            }
+            if (color == color_black || color == color_white)
+            {
+                color = color_cyan;
+                return;
+            }
+            const uint32_t shifted = color << 1;
+            color = (shifted | (shifted >> 3)) & color_white;
+        }
+        
+        void colorEdges(GlyphShape& shape)
+        {
+            for (auto& contour : shape.contours)
+            {
+                GlyphShape::Edge* edges = shape.edges.data() + contour.first;
+                const uint32_t m = contour.count;
+                if (m == 0)
+                {
+                    continue;
+                }
+                // find corners, a corner is at the start of an edge
+                std::vector<uint32_t> corners;
+                for (uint32_t i = 0; i < m; i += 1)
+                {
+                    const GlyphShape::Edge& prev = edges[(i + m - 1) % m];
+                    const GlyphShape::Edge& next = edges[i];
+                    const GlyphShape::Point a = direction(
+                        shape.points[prev.first + prev.count - 2], shape.points[prev.first + prev.count - 1]);
+                    const GlyphShape::Point b = direction(
+                        shape.points[next.first], shape.points[next.first + 1]);
+                    const float dot = a.x * b.x + a.y * b.y;
+                    const float cross = a.x * b.y - a.y * b.x;
+                    if (dot <= 0.0f || std::fabs(cross) > corner_cross_threshold)
+                    {
+                        corners.push_back(i);
+                    }
+                }
+                if (corners.empty())
+                {
+                    // smooth contour
+                    for (uint32_t i = 0; i < m; i += 1)
+                    {
+                        edges[i].color = color_white;
+                    }
+                }
+                else if (corners.size() == 1)
+                {
+                    // teardrop
+                    uint32_t colors[3] = { color_white, color_white, color_white };
+                    switchColor(colors[0], color_black);
+                    colors[2] = colors[0];
+                    switchColor(colors[2], color_black);
+                    if (m >= 3)
+                    {
+                        for (uint32_t i = 0; i < m; i += 1)
+                        {
+                            const int t = (int)(3.0f + 2.875f * (float)i / (float)(m - 1) - 1.4375f + 0.5f) - 3;
+                            edges[(corners[0] + i) % m].color = colors[1 + t];
+                        }
+                    }
+                    else
+                    {
+                        // too few edges to split, degrade to a plain distance field
+                        for (uint32_t i = 0; i < m; i += 1)
+                        {
+                            edges[i].color = color_white;
+                        }
+                    }
+                }
+                else
+                {
+                    const uint32_t count = (uint32_t)corners.size();
+                    const uint32_t start = corners[0];
+                    uint32_t spline = 0;
+                    uint32_t color = color_white;
+                    switchColor(color, color_black);
+                    const uint32_t initial = color;
+                    for (uint32_t i = 0; i < m; i += 1)
+                    {
+                        const uint32_t index = (start + i) % m;
+                        if (spline + 1 < count && corners[spline + 1] == index)
+                        {
+                            spline += 1;
+                            switchColor(color, (spline == count - 1) ? initial : color_black);
+                        }
+                        edges[index].color = color;
+                    }
+                }
+            }
+        }
+    }
+    
+    bool loadGlyphShape(FT_GlyphSlot glyph, GlyphShape& shape)
+    {
+        if (glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+        {
+            shape = GlyphShape();
+            return false;
+        }
+        return loadGlyphShape(&glyph->outline, shape);
+    }
+    bool loadGlyphShape(FT_Outline* outline, GlyphShape& shape)
+    {
+        shape.points.clear();
+        shape.edges.clear();
+        shape.contours.clear();
+        FT_Outline_Funcs funcs_ = {};
+        funcs_.move_to = &ShapeBuilder::moveTo;
+        funcs_.line_to = &ShapeBuilder::lineTo;
+        funcs_.conic_to = &ShapeBuilder::conicTo;
+        funcs_.cubic_to = &ShapeBuilder::cubicTo;
+        ShapeBuilder builder_ = { &shape, { 0.0f, 0.0f } };
+        if (FT_Outline_Decompose(outline, &funcs_, &builder_) != FT_Err_Ok)
+        {
+            return false;
+        }
+        shape.fill_right = FT_Outline_Get_Orientation(outline) != FT_ORIENTATION_FILL_LEFT;
+        colorEdges(shape);
+        return true;
+    }
+    
+    // distance field
+    
+    namespace
+    {
+        // 1D squared euclidean distance transform, Felzenszwalb & Huttenlocher
+        void distanceTransform1D(float* grid, size_t offset, size_t stride, uint32_t length,
+            float* f, uint32_t* v, float* z)
+        {
+            v[0] = 0;
+            z[0] = -distance_infinity;
+            z[1] = distance_infinity;
+            f[0] = grid[offset];
+            int32_t k = 0;
+            for (uint32_t q = 1; q < length; q += 1)
+            {
+                f[q] = grid[offset + q * stride];
+                const float q2 = (float)q * (float)q;
+                float s = 0.0f;
+                do
+                {
+                    const uint32_t r = v[k];
+                    s = (f[q] - f[r] + q2 - (float)r * (float)r) / (float)(q - r) / 2.0f;
+                } while (s <= z[k] && --k > -1);
+                k += 1;
+                v[k] = q;
+                z[k] = s;
+                z[k + 1] = distance_infinity;
+            }
+            k = 0;
+            for (uint32_t q = 0; q < length; q += 1)
+            {
+                while (z[k + 1] < (float)q)
+                {
+                    k += 1;
+                }
+                const uint32_t r = v[k];
+                const float qr = (float)q - (float)r;
+                grid[offset + q * stride] = f[r] + qr * qr;
+            }
+        }
+        
+        void distanceTransform2D(std::vector<float>& grid, uint32_t width, uint32_t height)
+        {
+            const uint32_t n = std::max(width, height);
+            std::vector<float> f(n);
+            std::vector<uint32_t> v(n);
+            std::vector<float> z(n + 1);
+            for (uint32_t x = 0; x < width; x += 1)
+            {
+                distanceTransform1D(grid.data(), x, width, height, f.data(), v.data(), z.data());
+            }
+            for (uint32_t y = 0; y < height; y += 1)
+            {
+                distanceTransform1D(grid.data(), (size_t)y * width, 1, width, f.data(), v.data(), z.data());
+            }
+        }
+    }
+    
+    void makeSignedDistanceField(GlyphImage& image, uint32_t spread)
+    {
+        assert(image.channels == 1);
+        const size_t size = (size_t)image.width * image.height;
+        if (size == 0)
+        {
+            return;
+        }
+        // anti-aliased pixels are seeded with their sub-pixel offset to the edge, same as TinySDF
+        std::vector<float> outer(size);
+        std::vector<float> inner(size);
+        for (size_t i = 0; i < size; i += 1)
+        {
+            const float a = (float)image.pixels[i] / 255.0f;
+            if (image.pixels[i] == 255)
+            {
+                outer[i] = 0.0f;
+                inner[i] = distance_infinity;
+            }
+            else if (image.pixels[i] == 0)
+            {
+                outer[i] = distance_infinity;
+                inner[i] = 0.0f;
+            }
+            else
+            {
+                const float d = 0.5f - a;
+                outer[i] = d > 0.0f ? d * d : 0.0f;
+                inner[i] = d < 0.0f ? d * d : 0.0f;
+            }
+        }
+        distanceTransform2D(outer, image.width, image.height);
+        distanceTransform2D(inner, image.width, image.height);
+        for (size_t i = 0; i < size; i += 1)
+        {
+            const float d = std::sqrt(inner[i]) - std::sqrt(outer[i]); // positive inside
+            image.pixels[i] = encodeDistance(d, spread);
+        }
+    }
+    
+    void makeMultiChannelSignedDistanceField(GlyphImage& image, const GlyphShape& shape, uint32_t spread)
+    {
+        assert(image.channels == 1);
+        if (shape.edges.empty())
+        {
+            makeSignedDistanceField(image, spread);
+            image.channels = 4;
+            std::vector<uint8_t> rgba(image.pixels.size() * 4);
+            for (size_t i = 0; i < image.pixels.size(); i += 1)
+            {
+                rgba[i * 4 + 0] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = rgba[i * 4 + 3] = image.pixels[i];
+            }
+            image.pixels = std::move(rgba);
+            return;
+        }
+        struct Distance
+        {
+            float distance = distance_infinity; // unsigned, to the closest point
+            float dot = 1.0f;                   // alignment of the edge and the closest direction, lower wins
+            float signed_distance = 0.0f;       // signed pseudo-distance, positive inside
+            
+            bool closer(const Distance& right) const
+            {
+                const float d = std::fabs(distance - right.distance);
+                if (d > 1e-5f)
+                {
+                    return distance < right.distance;
+                }
+                return dot < right.dot;
+            }
+        };
+        const float orient = shape.fill_right ? -1.0f : 1.0f;
+        auto evaluate_ = [&](const GlyphShape::Edge& edge, float px, float py) -> Distance
+        {
+            Distance best;
+            int32_t best_segment = -1;
+            float best_t = 0.0f;
+            const GlyphShape::Point* pts = shape.points.data() + edge.first;
+            const uint32_t segments = edge.count - 1;
+            for (uint32_t s = 0; s < segments; s += 1)
+            {
+                const float ax = pts[s].x, ay = pts[s].y;
+                const float abx = pts[s + 1].x - ax, aby = pts[s + 1].y - ay;
+                const float len2 = abx * abx + aby * aby;
+                if (len2 <= 0.0f)
+                {
+                    continue;
+                }
+                const float t = ((px - ax) * abx + (py - ay) * aby) / len2;
+                const float tc = std::clamp(t, 0.0f, 1.0f);
+                const float qx = px - (ax + tc * abx);
+                const float qy = py - (ay + tc * aby);
+                const float dist = std::sqrt(qx * qx + qy * qy);
+                if (dist < best.distance)
+                {
+                    const float len = std::sqrt(len2);
+                    const float cross = (abx * qy - aby * qx) / len;
+                    best.distance = dist;
+                    best.dot = dist > 0.0f ? std::fabs((abx * qx + aby * qy) / (len * dist)) : 0.0f;
+                    best.signed_distance = orient * (cross >= 0.0f ? dist : -dist);
+                    best_segment = (int32_t)s;
+                    best_t = t;
+                }
+            }
+            // pseudo-distance beyond the edge end points, use the extended tangent line
+            if (best_segment == 0 && best_t < 0.0f)
+            {
+                const GlyphShape::Point d = direction(pts[0], pts[1]);
+                const float aqx = px - pts[0].x, aqy = py - pts[0].y;
+                if (aqx * d.x + aqy * d.y < 0.0f)
+                {
+                    const float pseudo = orient * (d.x * aqy - d.y * aqx);
+                    if (std::fabs(pseudo) <= best.distance)
+                    {
+                        best.signed_distance = pseudo;
+                    }
+                }
+            }
+            else if (best_segment == (int32_t)segments - 1 && best_t > 1.0f)
+            {
+                const GlyphShape::Point d = direction(pts[segments - 1], pts[segments]);
+                const float bqx = px - pts[segments].x, bqy = py - pts[segments].y;
+                if (bqx * d.x + bqy * d.y > 0.0f)
+                {
+                    const float pseudo = orient * (d.x * bqy - d.y * bqx);
+                    if (std::fabs(pseudo) <= best.distance)
+                    {
+                        best.signed_distance = pseudo;
+                    }
+                }
+            }
+            return best;
+        };
+        std::vector<uint8_t> rgba((size_t)image.width * image.height * 4);
+        for (uint32_t y = 0; y < image.height; y += 1)
+        {
+            const uint8_t* coverage = image.row(y);
+            for (uint32_t x = 0; x < image.width; x += 1)
+            {
+                // pixel center in outline space
+                const float px = (float)image.bitmap_left + (float)x - (float)image.padding + 0.5f;
+                const float py = (float)image.bitmap_top - (float)y + (float)image.padding - 0.5f;
+                Distance channel[3];
+                Distance nearest;
+                for (auto& edge : shape.edges)
+                {
+                    const Distance d = evaluate_(edge, px, py);
+                    for (uint32_t c = 0; c < 3; c += 1)
+                    {
+                        if ((edge.color & (1u << c)) && d.closer(channel[c]))
+                        {
+                            channel[c] = d;
+                        }
+                    }
+                    if (d.closer(nearest))
+                    {
+                        nearest = d;
+                    }
+                }
+                // the rendered coverage decides inside or outside, fix channels which disagree with it
+                const bool inside = coverage[x] >= 128;
+                const float true_distance = inside ? nearest.distance : -nearest.distance;
+                float r = channel[0].distance < distance_infinity ? channel[0].signed_distance : true_distance;
+                float g = channel[1].distance < distance_infinity ? channel[1].signed_distance : true_distance;
+                float b = channel[2].distance < distance_infinity ? channel[2].signed_distance : true_distance;
+                const float median = std::max(std::min(r, g), std::min(std::max(r, g), b));
+                if ((median >= 0.0f) != inside)
+                {
+                    r = g = b = true_distance;
+                }
+                uint8_t* out = rgba.data() + ((size_t)y * image.width + x) * 4;
+                out[0] = encodeDistance(r, spread);
+                out[1] = encodeDistance(g, spread);
+                out[2] = encodeDistance(b, spread);
+                out[3] = encodeDistance(true_distance, spread);
+            }
+        }
+        image.channels = 4;
+        image.pixels = std::move(rgba);
+    }
+    
+    // stroke
+    
+    bool renderGlyphStroke(FT_Glyph glyph, FT_Stroker stroker, const GlyphImage& fill, GlyphImage& image)
+    {
+        FT_Glyph glyph_ = glyph;
+        if (glyph_ == NULL)
+        {
+            return false;
+        }
+        if (glyph_->format != FT_GLYPH_FORMAT_OUTLINE)
+        {
+            FT_Done_Glyph(glyph_);
+            return false;
+        }
+        // the outside border of every contour is the glyph dilated by the radius, holes shrink
+        if (FT_Glyph_StrokeBorder(&glyph_, stroker, false, true) != FT_Err_Ok
+            || FT_Glyph_To_Bitmap(&glyph_, FT_RENDER_MODE_NORMAL, NULL, true) != FT_Err_Ok)
+        {
+            FT_Done_Glyph(glyph_);
+            return false;
+        }
+        FT_BitmapGlyph bitmap_glyph_ = (FT_BitmapGlyph)glyph_;
+        const FT_Bitmap& bitmap = bitmap_glyph_->bitmap;
+        if (bitmap.pixel_mode != FT_PIXEL_MODE_GRAY || bitmap.num_grays != 256)
+        {
+            FT_Done_Glyph(glyph_);
+            return false;
+        }
+        const uint32_t padding = fill.padding;
+        image.width = bitmap.width + 2 * padding;
+        image.height = bitmap.rows + 2 * padding;
+        image.channels = 1;
+        image.padding = padding;
+        image.pixels.assign((size_t)image.width * image.height, 0);
+        const uint8_t* src = bitmap.buffer;
+        for (uint32_t y = 0; y < bitmap.rows; y += 1)
+        {
+            std::memcpy(image.row(y + padding) + padding, src, bitmap.width);
+            src += bitmap.pitch;
+        }
+        // the stroke is larger than the fill, move the bearing by the bitmap offset
+        const float dx = (float)(bitmap_glyph_->left - fill.bitmap_left);
+        const float dy = (float)(bitmap_glyph_->top - fill.bitmap_top);
+        image.metrics_width = (float)bitmap.width;
+        image.metrics_height = (float)bitmap.rows;
+        image.h_bearing_x = fill.h_bearing_x + dx;
+        image.h_bearing_y = fill.h_bearing_y + dy;
+        image.h_advance = fill.h_advance;
+        image.v_bearing_x = fill.v_bearing_x + dx;
+        image.v_bearing_y = fill.v_bearing_y + dy;
+        image.v_advance = fill.v_advance;
+        image.bitmap_left = bitmap_glyph_->left;
+        image.bitmap_top = bitmap_glyph_->top;
+        FT_Done_Glyph(glyph_);
+        return true;
+    }
+    
+    // shadow
+    
+    // dst += weight * src, the only inner loop of the separable blur
+    static void accumulateRow(float* dst, const float* src, float weight, size_t count)
+    {
+        size_t i = 0;
+    #ifdef FONTATLAS_SSE2
+        const __m128 w = _mm_set1_ps(weight);
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 d = _mm_loadu_ps(dst + i);
+            const __m128 s = _mm_loadu_ps(src + i);
+            _mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(s, w)));
+        }
+    #endif
+        for (; i < count; i += 1)
+        {
+            dst[i] += weight * src[i];
+        }
+    }
+    
+    // separable gaussian blur of an 8 bit image, outside of the image is 0
+    static void gaussianBlur(uint8_t* pixels, uint32_t width, uint32_t height, float radius)
+    {
+        const uint32_t r = (uint32_t)std::ceil(radius);
+        if (r == 0 || width == 0 || height == 0)
+        {
+            return;
+        }
+        // radius covers 3 sigma
+        const float sigma = radius / 3.0f;
+        std::vector<float> kernel(2 * r + 1);
+        float sum = 0.0f;
+        for (uint32_t k = 0; k < kernel.size(); k += 1)
+        {
+            const float x = (float)k - (float)r;
+            kernel[k] = std::exp(-x * x / (2.0f * sigma * sigma));
+            sum += kernel[k];
+        }
+        for (auto& k : kernel)
+        {
+            k /= sum;
+        }
+        // horizontal, every source row has r zeros on both sides
+        const size_t stride = (size_t)width + 2 * r;
+        std::vector<float> source(stride * height, 0.0f);
+        for (uint32_t y = 0; y < height; y += 1)
+        {
+            const uint8_t* in = pixels + (size_t)y * width;
+            float* line = source.data() + (size_t)y * stride + r;
+            for (uint32_t x = 0; x < width; x += 1)
+            {
+                line[x] = (float)in[x];
+            }
+        }
+        // vertical source has r zero rows above and below
+        std::vector<float> column((size_t)width * (height + 2 * r), 0.0f);
+        for (uint32_t y = 0; y < height; y += 1)
+        {
+            float* out = column.data() + (size_t)(y + r) * width;
+            const float* line = source.data() + (size_t)y * stride;
+            for (uint32_t k = 0; k < kernel.size(); k += 1)
+            {
+                accumulateRow(out, line + k, kernel[k], width);
+            }
+        }
+        std::vector<float> result(width, 0.0f);
+        for (uint32_t y = 0; y < height; y += 1)
+        {
+            std::fill(result.begin(), result.end(), 0.0f);
+            for (uint32_t k = 0; k < kernel.size(); k += 1)
+            {
+                accumulateRow(result.data(), column.data() + (size_t)(y + k) * width, kernel[k], width);
+            }
+            uint8_t* out = pixels + (size_t)y * width;
+            for (uint32_t x = 0; x < width; x += 1)
+            {
+                out[x] = (uint8_t)std::clamp(result[x] + 0.5f, 0.0f, 255.0f);
+            }
+        }
+    }
+    
+    void makeGlyphShadow(const GlyphImage& source, float radius, int32_t offset_x, int32_t offset_y, GlyphImage& image)
+    {
+        assert(source.channels == 1);
+        const uint32_t grow = (uint32_t)std::ceil(std::max(radius, 0.0f));
+        image = GlyphImage();
+        image.width = source.width + 2 * grow;
+        image.height = source.height + 2 * grow;
+        image.channels = 1;
+        image.padding = source.padding + grow;
+        image.pixels.assign((size_t)image.width * image.height, 0);
+        for (uint32_t y = 0; y < source.height; y += 1)
+        {
+            std::memcpy(image.row(y + grow) + grow, source.pixels.data() + (size_t)y * source.width, source.width);
+        }
+        gaussianBlur(image.pixels.data(), image.width, image.height, radius);
+        // same content rectangle as the source, moved by the offset (y down)
+        image.metrics_width = source.metrics_width;
+        image.metrics_height = source.metrics_height;
+        image.h_bearing_x = source.h_bearing_x + (float)offset_x;
+        image.h_bearing_y = source.h_bearing_y - (float)offset_y;
+        image.h_advance = source.h_advance;
+        image.v_bearing_x = source.v_bearing_x + (float)offset_x;
+        image.v_bearing_y = source.v_bearing_y - (float)offset_y;
+        image.v_advance = source.v_advance;
+        image.bitmap_left = source.bitmap_left + offset_x;
+        image.bitmap_top = source.bitmap_top - offset_y;
+    }
+    
+    void combineGlyphLayers(const GlyphImage& fill, const GlyphImage* stroke, const GlyphImage* shadow, GlyphImage& image)
+    {
+        assert(fill.channels == 1);
+        // union of the layer rectangles in pixel, y up, padding included
+        const GlyphImage* layer[3] = { &fill, stroke, shadow };
+        int32_t left = fill.bitmap_left - (int32_t)fill.padding;
+        int32_t top = fill.bitmap_top + (int32_t)fill.padding;
+        int32_t right = left + (int32_t)fill.width;
+        int32_t bottom = top - (int32_t)fill.height;
+        for (auto* v : layer)
+        {
+            if (v)
+            {
+                assert(v->channels == 1);
+                const int32_t l = v->bitmap_left - (int32_t)v->padding;
+                const int32_t t = v->bitmap_top + (int32_t)v->padding;
+                left = std::min(left, l);
+                top = std::max(top, t);
+                right = std::max(right, l + (int32_t)v->width);
+                bottom = std::min(bottom, t - (int32_t)v->height);
+            }
+        }
+        image = GlyphImage();
+        image.width = (uint32_t)(right - left);
+        image.height = (uint32_t)(top - bottom);
+        image.channels = 4;
+        image.padding = fill.padding;
+        image.pixels.assign((size_t)image.width * image.height * 4, 0);
+        image.bitmap_left = left + (int32_t)image.padding;
+        image.bitmap_top = top - (int32_t)image.padding;
+        // move the bearing by the bitmap offset, the same as the stroke
+        const float dx = (float)(image.bitmap_left - fill.bitmap_left);
+        const float dy = (float)(image.bitmap_top - fill.bitmap_top);
+        image.metrics_width = (float)(image.width - 2 * image.padding);
+        image.metrics_height = (float)(image.height - 2 * image.padding);
+        image.h_bearing_x = fill.h_bearing_x + dx;
+        image.h_bearing_y = fill.h_bearing_y + dy;
+        image.h_advance = fill.h_advance;
+        image.v_bearing_x = fill.v_bearing_x + dx;
+        image.v_bearing_y = fill.v_bearing_y + dy;
+        image.v_advance = fill.v_advance;
+        auto blit_ = [&](const GlyphImage& v, uint32_t c)
+        {
+            const uint32_t ox = (uint32_t)(v.bitmap_left - (int32_t)v.padding - left);
+            const uint32_t oy = (uint32_t)(top - v.bitmap_top - (int32_t)v.padding);
+            for (uint32_t y = 0; y < v.height; y += 1)
+            {
+                const uint8_t* in = v.pixels.data() + (size_t)y * v.width;
+                uint8_t* out = image.row(y + oy) + (size_t)ox * 4;
+                for (uint32_t x = 0; x < v.width; x += 1)
+                {
+                    out[x * 4 + c] = in[x];
+                }
+            }
+        };
+        blit_(fill, 0);
+        blit_(stroke ? *stroke : fill, 1);
+        if (shadow)
+        {
+            blit_(*shadow, 2);
+        }
+        // the stroke covers the fill, alpha is the union of all layers
+        for (uint32_t i = 0; i < image.width * image.height; i += 1)
+        {
+            uint8_t* px = image.pixels.data() + (size_t)i * 4;
+            px[1] = std::max(px[0], px[1]);
+            px[3] = std::max(px[1], px[2]);
+        }
+    }
+}
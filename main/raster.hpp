@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "ft2build.h"
+#include FT_FREETYPE_H
+#include FT_GLYPH_H
+#include FT_STROKER_H
+
+namespace fontatlas
+{
+    // rendered glyph, padding is already included in width and height
+    struct GlyphImage
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t channels = 1; // 1 coverage or distance, 4 rgba
+        uint32_t padding = 0;
+        std::vector<uint8_t> pixels; // interleaved channels, top to bottom
+        // glyph metrics in pixel, padding not included
+        float metrics_width = 0.0f;
+        float metrics_height = 0.0f;
+        float h_bearing_x = 0.0f;
+        float h_bearing_y = 0.0f;
+        float h_advance = 0.0f;
+        float v_bearing_x = 0.0f;
+        float v_bearing_y = 0.0f;
+        float v_advance = 0.0f;
+        // bitmap origin in pixel, y up, padding not included
+        int32_t bitmap_left = 0;
+        int32_t bitmap_top = 0;
+        
+        uint8_t* row(uint32_t y) { return pixels.data() + (size_t)y * width * channels; }
+    };
+    
+    // glyph outline flattened to polylines, in pixel, y up
+    struct GlyphShape
+    {
+        struct Point
+        {
+            float x;
+            float y;
+        };
+        struct Edge
+        {
+            uint32_t first; // index of the first point
+            uint32_t count; // at least 2 points
+            uint32_t color; // bit 0 r, bit 1 g, bit 2 b
+        };
+        struct Contour
+        {
+            uint32_t first; // index of the first edge
+            uint32_t count;
+        };
+        std::vector<Point> points;
+        std::vector<Edge> edges;
+        std::vector<Contour> contours;
+        bool fill_right = true; // truetype orientation
+    };
+    
+    // copy glyph metrics and an 8 bit gray bitmap, surrounded by padding
+    bool copyGlyphImage(FT_GlyphSlot glyph, uint32_t padding, GlyphImage& image);
+    
+    // rasterize a scaled outline glyph with FT_Outline_Get_Bitmap, metrics are in font units and
+    // multiplied by scale (16.16, font units to 26.6)
+    bool renderGlyphOutline(FT_Library library, FT_OutlineGlyph glyph, const FT_Glyph_Metrics& metrics, FT_Fixed scale,
+        uint32_t padding, GlyphImage& image);
+    
+    // decompose the outline of the glyph slot and assign edge colors for msdf
+    bool loadGlyphShape(FT_GlyphSlot glyph, GlyphShape& shape);
+    bool loadGlyphShape(FT_Outline* outline, GlyphShape& shape);
+    
+    // replace coverage with a signed distance field, 128 is on the edge, spread is in pixel
+    void makeSignedDistanceField(GlyphImage& image, uint32_t spread);
+    
+    // replace coverage with a multi-channel signed distance field in rgb and the true distance in alpha
+    void makeMultiChannelSignedDistanceField(GlyphImage& image, const GlyphShape& shape, uint32_t spread);
+    
+    // render an outline glyph (from FT_Get_Glyph, always released) dilated by the stroker radius,
+    // the other metrics are taken from the fill image
+    bool renderGlyphStroke(FT_Glyph glyph, FT_Stroker stroker, const GlyphImage& fill, GlyphImage& image);
+    
+    // blur the coverage of source with a gaussian, radius is 3 sigma in pixel and grows the padding,
+    // the offset is in pixel, y down
+    void makeGlyphShadow(const GlyphImage& source, float radius, int32_t offset_x, int32_t offset_y, GlyphImage& image);
+    
+    // put the layers into one rgba image on the union rectangle: r fill, g stroke (or fill), b shadow, a max of all
+    void combineGlyphLayers(const GlyphImage& fill, const GlyphImage* stroke, const GlyphImage* shadow, GlyphImage& image);
+}
@@ -1,8 +1,14 @@
 #include "texture.hpp"
 #include "common.hpp"
+#include "trace.hpp"
 #include <cassert>
 #include <cstdio>
+#include <algorithm>
 #include <filesystem>
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define FONTATLAS_SSE2
+#include <emmintrin.h>
+#endif
 #define  WIN32_LEAN_AND_MEAN
 #define  NOMINMAX
 #include <Windows.h>
@@ -73,7 +79,7 @@ namespace fontatlas
         if (!write_(&bmp_file_head_, sizeof(bmp_file_head_))) return false;
         if (!write_(&bmp_info_head_, sizeof(bmp_info_head_))) return false;
         Color* px = _pixels.data() + _height * _width;
-        for (uint32_t v = _height; v > 0; v += 1)
+        for (uint32_t v = _height; v > 0; v -= 1)
         {
             px -= _width;
             if (!write_(px, sizeof(Color) * _width)) return false;
@@ -84,6 +90,10 @@ namespace fontatlas
     {
         HRESULT hr = 0;
         
+        // builds run on any thread, worker threads included, so the encoder does not rely on the caller
+        // having initialized COM; nested initialization only adds a reference
+        ScopeCoInitialize co_;
+        
         // create factory
         Microsoft::WRL::ComPtr<IWICImagingFactory> wicfac;
         hr = CoCreateInstance(CLSID_WICImagingFactory1, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(wicfac.GetAddressOf()));
@@ -170,6 +180,129 @@ namespace fontatlas
         
         return true;
     }
+    namespace
+    {
+        // dds.h is not part of the windows sdk
+        struct DDSPixelFormat
+        {
+            uint32_t size;
+            uint32_t flags;
+            uint32_t fourcc;
+            uint32_t rgb_bit_count;
+            uint32_t r_mask;
+            uint32_t g_mask;
+            uint32_t b_mask;
+            uint32_t a_mask;
+        };
+        struct DDSHeader
+        {
+            uint32_t size;
+            uint32_t flags;
+            uint32_t height;
+            uint32_t width;
+            uint32_t pitch;
+            uint32_t depth;
+            uint32_t mip_count;
+            uint32_t reserved1[11];
+            DDSPixelFormat format;
+            uint32_t caps;
+            uint32_t caps2;
+            uint32_t caps3;
+            uint32_t caps4;
+            uint32_t reserved2;
+        };
+        static_assert(sizeof(DDSHeader) == 124, "DDS_HEADER size");
+        
+        constexpr uint32_t dds_magic = 0x20534444; // "DDS "
+        constexpr uint32_t ddsd_caps = 0x1;
+        constexpr uint32_t ddsd_height = 0x2;
+        constexpr uint32_t ddsd_width = 0x4;
+        constexpr uint32_t ddsd_pitch = 0x8;
+        constexpr uint32_t ddsd_pixelformat = 0x1000;
+        constexpr uint32_t ddsd_mipmapcount = 0x20000;
+        constexpr uint32_t ddpf_alphapixels = 0x1;
+        constexpr uint32_t ddpf_rgb = 0x40;
+        constexpr uint32_t ddscaps_complex = 0x8;
+        constexpr uint32_t ddscaps_texture = 0x1000;
+        constexpr uint32_t ddscaps_mipmap = 0x400000;
+    }
+    
+    bool Texture::_saveDDS(const std::wstring_view path, uint32_t levels)
+    {
+        // create file
+        Microsoft::WRL::Wrappers::FileHandle file;
+        file.Attach(CreateFileW(
+            path.data(),
+            GENERIC_READ | GENERIC_WRITE,
+            0,
+            NULL,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL,
+            NULL
+        ));
+        if (!file.IsValid())
+        {
+            return false;
+        }
+        
+        // method
+        auto write_ = [&](const void* data, size_t size) -> bool {
+            assert(size <= 0x7FFFFFFF);
+            if (size > 0x7FFFFFFF)
+            {
+                return false;
+            }
+            DWORD write_size_ = 0;
+            if (FALSE == WriteFile(file.Get(), data, size & 0x7FFFFFFF, &write_size_, NULL))
+            {
+                assert(false);
+                return false;
+            }
+            assert(write_size_ == size);
+            if (write_size_ != size)
+            {
+                return false;
+            }
+            return true;
+        };
+        
+        // head data, memory order of Color is B G R A
+        DDSHeader head_ = {};
+        head_.size = sizeof(DDSHeader);
+        head_.flags = ddsd_caps | ddsd_height | ddsd_width | ddsd_pitch | ddsd_pixelformat;
+        head_.height = _height;
+        head_.width = _width;
+        head_.pitch = _width * sizeof(Color);
+        head_.mip_count = levels + 1;
+        head_.format.size = sizeof(DDSPixelFormat);
+        head_.format.flags = ddpf_rgb | ddpf_alphapixels;
+        head_.format.rgb_bit_count = 32;
+        head_.format.r_mask = 0x00FF0000;
+        head_.format.g_mask = 0x0000FF00;
+        head_.format.b_mask = 0x000000FF;
+        head_.format.a_mask = 0xFF000000;
+        head_.caps = ddscaps_texture;
+        if (levels > 0)
+        {
+            head_.flags |= ddsd_mipmapcount;
+            head_.caps |= ddscaps_complex | ddscaps_mipmap;
+        }
+        
+        // write data, largest level first
+        if (!write_(&dds_magic, sizeof(dds_magic))) return false;
+        if (!write_(&head_, sizeof(head_))) return false;
+        if (!write_(_pixels.data(), sizeof(Color) * _pixels.size())) return false;
+        Texture mip_ = levels > 0 ? downsample() : Texture(0, 0);
+        for (uint32_t level = 1; level <= levels; level += 1)
+        {
+            if (!write_(mip_._pixels.data(), sizeof(Color) * mip_._pixels.size())) return false;
+            if (level < levels)
+            {
+                mip_ = mip_.downsample();
+            }
+        }
+        return true;
+    }
     uint32_t Texture::width() { return _width; }
     uint32_t Texture::height() { return _height; }
     Color& Texture::pixel(uint32_t x, uint32_t y)
@@ -177,12 +310,56 @@ namespace fontatlas
         assert(x < _width && y < _height);
         return _pixels[y * _width + x];
     }
-    bool Texture::save(const std::string_view path, ImageFileFormat format)
+    Texture Texture::downsample() const
+    {
+        Texture mip_(std::max(_width / 2, 1u), std::max(_height / 2, 1u));
+        for (uint32_t y = 0; y < mip_._height; y += 1)
+        {
+            // odd sizes repeat the last row and column
+            const Color* row0 = _pixels.data() + (size_t)std::min(y * 2, _height - 1) * _width;
+            const Color* row1 = _pixels.data() + (size_t)std::min(y * 2 + 1, _height - 1) * _width;
+            Color* out = mip_._pixels.data() + (size_t)y * mip_._width;
+            uint32_t x = 0;
+        #ifdef FONTATLAS_SSE2
+            // 2 output pixels from 4 x 2 source pixels, sums in 16 bit lanes
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i round = _mm_set1_epi16(2);
+            for (; x * 2 + 4 <= _width && x + 2 <= mip_._width; x += 2)
+            {
+                const __m128i a = _mm_loadu_si128((const __m128i*)(row0 + x * 2));
+                const __m128i b = _mm_loadu_si128((const __m128i*)(row1 + x * 2));
+                const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+                const __m128i sum_lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+                const __m128i sum_hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+                const __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(sum_lo, sum_hi), round), 2);
+                _mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(sum, sum));
+            }
+        #endif
+            for (; x < mip_._width; x += 1)
+            {
+                const uint32_t x0 = std::min(x * 2, _width - 1);
+                const uint32_t x1 = std::min(x * 2 + 1, _width - 1);
+                const Color& p00 = row0[x0];
+                const Color& p01 = row0[x1];
+                const Color& p10 = row1[x0];
+                const Color& p11 = row1[x1];
+                out[x] = Color(
+                    (uint8_t)((p00.r + p01.r + p10.r + p11.r + 2) >> 2),
+                    (uint8_t)((p00.g + p01.g + p10.g + p11.g + 2) >> 2),
+                    (uint8_t)((p00.b + p01.b + p10.b + p11.b + 2) >> 2),
+                    (uint8_t)((p00.a + p01.a + p10.a + p11.a + 2) >> 2));
+            }
+        }
+        return mip_;
+    }
+    bool Texture::save(const std::string_view path, ImageFileFormat format, uint32_t levels)
     {
+        TraceScope trace_("encode", "save %.*s", (int)path.size(), path.data());
         std::wstring wpath = std::move(toWide(path));
-        return save(wpath);
+        return save(wpath, format, levels);
     }
-    bool Texture::save(const std::wstring_view path, ImageFileFormat format)
+    bool Texture::save(const std::wstring_view path, ImageFileFormat format, uint32_t levels)
     {
         switch(format)
         {
@@ -190,6 +367,8 @@ namespace fontatlas
             return _saveBMP(path);
         case ImageFileFormat::PNG:
             return _savePNG(path);
+        case ImageFileFormat::DDS:
+            return _saveDDS(path, levels);
         default:
             return false;
         }
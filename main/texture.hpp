@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -32,6 +33,7 @@ namespace fontatlas
     {
         BMP,
         PNG,
+        DDS, // uncompressed BGRA8, mip levels are stored in the same file
     };
     
     class Texture
@@ -43,12 +45,14 @@ namespace fontatlas
     private:
         bool _saveBMP(const std::wstring_view path);
         bool _savePNG(const std::wstring_view path);
+        bool _saveDDS(const std::wstring_view path, uint32_t levels);
     public:
         uint32_t width();
         uint32_t height();
         Color& pixel(uint32_t x, uint32_t y);
-        bool save(const std::string_view path, ImageFileFormat format = ImageFileFormat::PNG);
-        bool save(const std::wstring_view path, ImageFileFormat format = ImageFileFormat::PNG);
+        Texture downsample() const; // 2x2 box filter, half size (at least 1 pixel)
+        bool save(const std::string_view path, ImageFileFormat format = ImageFileFormat::PNG, uint32_t levels = 0);
+        bool save(const std::wstring_view path, ImageFileFormat format = ImageFileFormat::PNG, uint32_t levels = 0); // levels: extra mip levels for DDS
         void clear(Color c = Color(0, 0, 0, 0));
     public:
         Texture(uint32_t width, uint32_t height);
@@ -0,0 +1,143 @@
+#include "trace.hpp"
+#include "common.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+
+namespace fontatlas
+{
+    static std::atomic<uint32_t> trace_thread_count_{ 0 };
+    
+    static void writeJsonString(std::string& out, const std::string_view str)
+    {
+        out.push_back('"');
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if ((uint8_t)c < 0x20)
+            {
+                char buffer_[8] = {};
+                std::snprintf(buffer_, 8, "\\u%04x", (uint32_t)(uint8_t)c);
+                out.append(buffer_);
+            }
+            else
+            {
+                out.push_back(c);
+            }
+        }
+        out.push_back('"');
+    }
+    
+    bool Tracer::start(const std::string_view path, const void* owner)
+    {
+        std::lock_guard<std::mutex> lock_(_lock);
+        if (path.empty() || _enable.load())
+        {
+            return false;
+        }
+        _path = path;
+        _owner = owner;
+        _event.clear();
+        _start = now();
+        _mainthread = threadID();
+        _enable.store(true);
+        return true;
+    }
+    bool Tracer::stop(const void* owner)
+    {
+        std::lock_guard<std::mutex> lock_(_lock);
+        if (!_enable.load() || _owner != owner)
+        {
+            return false;
+        }
+        _enable.store(false);
+        // one complete event ("ph":"X") per span, plus a name for every thread seen
+        std::string out_;
+        out_.reserve(_event.size() * 96 + 256);
+        out_.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        std::vector<uint32_t> thread_;
+        char buffer_[256] = {};
+        for (auto& v : _event)
+        {
+            out_.append("{\"name\":");
+            writeJsonString(out_, v.name);
+            const int n = std::snprintf(buffer_, 256, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u},\n",
+                v.category, v.begin, v.duration, v.thread);
+            out_.append(buffer_, n);
+            if (std::find(thread_.begin(), thread_.end(), v.thread) == thread_.end())
+            {
+                thread_.push_back(v.thread);
+            }
+        }
+        for (uint32_t tid : thread_)
+        {
+            const int n = (tid == _mainthread)
+                ? std::snprintf(buffer_, 256, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"main\"}},\n", tid)
+                : std::snprintf(buffer_, 256, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"worker %u\"}},\n", tid, tid);
+            out_.append(buffer_, n);
+        }
+        out_.append("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"fontatlas\"}}\n]}\n");
+        _event.clear();
+        _event.shrink_to_fit();
+        std::ofstream file_(toWide(_path), std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!file_.is_open())
+        {
+            return false;
+        }
+        file_.write(out_.data(), out_.size());
+        return file_.good();
+    }
+    double Tracer::now() const noexcept
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    void Tracer::complete(const char* category, std::string name, double begin, double end)
+    {
+        const uint32_t thread_ = threadID();
+        std::lock_guard<std::mutex> lock_(_lock);
+        if (_enable.load(std::memory_order_relaxed) && begin >= _start)
+        {
+            _event.push_back(Event{ std::move(name), category, begin - _start, end - begin, thread_ });
+        }
+    }
+    uint32_t Tracer::threadID() noexcept
+    {
+        thread_local const uint32_t id_ = trace_thread_count_.fetch_add(1) + 1;
+        return id_;
+    }
+    Tracer& Tracer::get()
+    {
+        static Tracer instance_;
+        return instance_;
+    }
+    
+    TraceScope::TraceScope(const char* category, const char* fmt, ...)
+    {
+        Tracer& tracer_ = Tracer::get();
+        if (!tracer_.enabled())
+        {
+            return;
+        }
+        char buffer_[256] = {};
+        va_list arg_;
+        va_start(arg_, fmt);
+        std::vsnprintf(buffer_, 256, fmt, arg_);
+        va_end(arg_);
+        _category = category;
+        _name = buffer_;
+        _begin = tracer_.now();
+    }
+    TraceScope::~TraceScope()
+    {
+        if (_category != nullptr)
+        {
+            Tracer& tracer_ = Tracer::get();
+            tracer_.complete(_category, std::move(_name), _begin, tracer_.now());
+        }
+    }
+}
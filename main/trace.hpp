@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+namespace fontatlas
+{
+    // chrome trace event recorder, the file loads in perfetto and chrome://tracing
+    // one session per process records the spans of every thread, so only one trace can run at a time
+    class Tracer
+    {
+    private:
+        struct Event
+        {
+            std::string name;
+            const char* category;
+            double begin; // microseconds since the session start
+            double duration;
+            uint32_t thread;
+        };
+        std::mutex _lock;
+        std::atomic<bool> _enable{ false };
+        std::string _path;
+        const void* _owner = nullptr;
+        double _start = 0.0; // now() at the session start, guarded by _lock
+        std::vector<Event> _event;
+        uint32_t _mainthread = 0;
+    public:
+        // begin recording, events are written on stop; fails while another session is recording
+        bool start(const std::string_view path, const void* owner = nullptr);
+        bool stop(const void* owner = nullptr); // write the json file and stop recording, only the owner can
+        bool enabled() const noexcept { return _enable.load(std::memory_order_relaxed); }
+        double now() const noexcept; // steady clock microseconds, independent of the session
+        // spans that began before the current session started are dropped
+        void complete(const char* category, std::string name, double begin, double end);
+    public:
+        static uint32_t threadID() noexcept; // small sequential id of the calling thread
+        static Tracer& get();
+    };
+    
+    // one span from construction to destruction, names are only formatted while recording
+    class TraceScope
+    {
+    private:
+        const char* _category = nullptr;
+        std::string _name;
+        double _begin = 0.0;
+    public:
+        TraceScope(const char* category, const char* fmt, ...);
+        ~TraceScope();
+    };
+}
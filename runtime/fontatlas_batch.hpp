@@ -0,0 +1,227 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include "fontatlas_runtime.hpp"
+
+// cpu text batcher, turns utf-8 strings into quads grouped by page so one draw covers a whole page
+
+namespace fontatlas::runtime
+{
+    // same layout as the vertex of the d3d9 test viewer
+    struct Vertex
+    {
+        float x, y, z;
+        float u, v;
+        uint32_t color;   // d3dcolor argb
+        uint32_t channel; // argb mask of the channel to sample
+    };
+    
+    // quads of one page, draw with base vertex first_vertex and the shared index pattern from 0
+    struct DrawCommand
+    {
+        uint32_t texture; // 1-based page number
+        uint32_t first_vertex;
+        uint32_t quad_count; // at most max_batch_quads
+    };
+    
+    // 16 bit indices address 65536 vertices
+    constexpr uint32_t max_batch_quads = 16384;
+    
+    // static index pattern 0 1 2 0 2 3, 4 5 6 4 6 7, ... for quad_count quads
+    inline void makeQuadIndices(uint16_t* indices, uint32_t quad_count)
+    {
+        quad_count = std::min(quad_count, max_batch_quads);
+        for (uint32_t i = 0; i < quad_count; i += 1)
+        {
+            const uint16_t v = (uint16_t)(i * 4);
+            indices[0] = v;
+            indices[1] = v + 1;
+            indices[2] = v + 2;
+            indices[3] = v;
+            indices[4] = v + 2;
+            indices[5] = v + 3;
+            indices += 6;
+        }
+    }
+    
+    // decode one code point and advance p, invalid sequences give U+FFFD and skip one byte
+    inline uint32_t decodeUtf8(const char*& p, const char* end) noexcept
+    {
+        const uint8_t c = (uint8_t)*p;
+        if (c < 0x80)
+        {
+            p += 1;
+            return c;
+        }
+        uint32_t n = 0;
+        uint32_t code = 0;
+        if ((c & 0xE0) == 0xC0) { n = 1; code = c & 0x1F; }
+        else if ((c & 0xF0) == 0xE0) { n = 2; code = c & 0x0F; }
+        else if ((c & 0xF8) == 0xF0) { n = 3; code = c & 0x07; }
+        if (n == 0 || end - p <= (ptrdiff_t)n)
+        {
+            p += 1;
+            return 0xFFFD;
+        }
+        for (uint32_t i = 1; i <= n; i += 1)
+        {
+            const uint8_t t = (uint8_t)p[i];
+            if ((t & 0xC0) != 0x80)
+            {
+                p += 1;
+                return 0xFFFD;
+            }
+            code = (code << 6) | (t & 0x3F);
+        }
+        p += n + 1;
+        return code;
+    }
+    
+    class TextBatch
+    {
+    private:
+        struct Quad
+        {
+            float x0, y0, x1, y1;
+            float u0, v0, u1, v1;
+            float z;
+            uint32_t color;
+            uint32_t key; // texture << 2 | channel
+        };
+        std::vector<Quad> _quad;
+        size_t _count = 0;
+        uint32_t _max_key = 0;
+        std::vector<uint32_t> _offset;
+        std::vector<Vertex> _vertex;
+        std::vector<DrawCommand> _command;
+        float _u_scale = 1.0f;
+        float _v_scale = 1.0f;
+    public:
+        // buffers are sized once for reserve_quads glyphs and only grow when a frame needs more
+        explicit TextBatch(uint32_t reserve_quads = max_batch_quads)
+        {
+            _quad.resize(reserve_quads);
+            _vertex.reserve((size_t)reserve_quads * 4);
+            _command.reserve(64);
+        }
+        // page size in texel, uv in the index are in texel
+        void setTextureSize(uint32_t width, uint32_t height)
+        {
+            _u_scale = width > 0 ? 1.0f / (float)width : 1.0f;
+            _v_scale = height > 0 ? 1.0f / (float)height : 1.0f;
+        }
+        void clear() noexcept
+        {
+            _count = 0;
+            _max_key = 0;
+            _vertex.clear();
+            _command.clear();
+        }
+        // lay out a string from the baseline origin (x, y), y down, new lines move down by the font height,
+        // returns the number of glyphs added, code points missing from the font are skipped
+        size_t addText(const Font& font, std::string_view text, float x, float y, uint32_t color,
+            float scale = 1.0f, float z = 0.0f)
+        {
+            const GlyphTable& table = font.glyphs;
+            const bool kerning = !font.kerning.empty();
+            const char* p = text.data();
+            const char* end = p + text.size();
+            const size_t first = _count;
+            float pen_x = x;
+            float pen_y = y;
+            uint32_t last = 0;
+            // worst case one quad per byte, so the loop below never reallocates
+            if (_quad.size() < _count + text.size())
+            {
+                _quad.resize(std::max(_quad.size() * 2, _count + text.size()));
+            }
+            Quad* quad = _quad.data() + _count;
+            while (p < end)
+            {
+                const uint32_t code = decodeUtf8(p, end);
+                if (code == '\n')
+                {
+                    pen_x = x;
+                    pen_y += font.height * scale;
+                    last = 0;
+                    continue;
+                }
+                const uint32_t index = table.find(code);
+                if (index == invalid_glyph)
+                {
+                    last = 0;
+                    continue;
+                }
+                if (kerning && last != 0)
+                {
+                    pen_x += font.kern(last, code) * scale;
+                }
+                last = code;
+                const Pen& pen = table.horizontal()[index];
+                const Rect& uv = table.uv()[index];
+                const float* draw = table.draw() + (size_t)index * 2;
+                quad->x0 = pen_x + pen.x * scale;
+                quad->y0 = pen_y - pen.y * scale;
+                quad->x1 = quad->x0 + draw[0] * scale;
+                quad->y1 = quad->y0 + draw[1] * scale;
+                quad->u0 = uv.x * _u_scale;
+                quad->v0 = uv.y * _v_scale;
+                quad->u1 = (uv.x + uv.width) * _u_scale;
+                quad->v1 = (uv.y + uv.height) * _v_scale;
+                quad->z = z;
+                quad->color = color;
+                quad->key = ((uint32_t)table.texture()[index] << 2) | (table.channel()[index] & 3);
+                _max_key = std::max(_max_key, quad->key);
+                quad += 1;
+                pen_x += pen.advance * scale;
+            }
+            _count = (size_t)(quad - _quad.data());
+            return _count - first;
+        }
+        // sort the quads by page then channel (stable) and write vertices and draw commands
+        void finish()
+        {
+            static constexpr uint32_t channel_mask[4] = { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 };
+            _offset.assign((size_t)_max_key + 2, 0);
+            for (size_t i = 0; i < _count; i += 1)
+            {
+                _offset[_quad[i].key + 1] += 1;
+            }
+            for (size_t k = 1; k < _offset.size(); k += 1)
+            {
+                _offset[k] += _offset[k - 1];
+            }
+            _vertex.resize(_count * 4);
+            Vertex* vertex = _vertex.data();
+            for (size_t i = 0; i < _count; i += 1)
+            {
+                const Quad& q = _quad[i];
+                const uint32_t mask = channel_mask[q.key & 3];
+                Vertex* v = vertex + (size_t)_offset[q.key]++ * 4;
+                v[0] = Vertex{ q.x0, q.y0, q.z, q.u0, q.v0, q.color, mask };
+                v[1] = Vertex{ q.x1, q.y0, q.z, q.u1, q.v0, q.color, mask };
+                v[2] = Vertex{ q.x1, q.y1, q.z, q.u1, q.v1, q.color, mask };
+                v[3] = Vertex{ q.x0, q.y1, q.z, q.u0, q.v1, q.color, mask };
+            }
+            // after the scatter _offset[k] is the end of key k, pages are runs of 4 keys
+            _command.clear();
+            uint32_t begin = 0;
+            for (uint32_t texture = 0; ((size_t)texture << 2) < _offset.size() - 1; texture += 1)
+            {
+                const uint32_t end = _offset[std::min(((size_t)texture << 2) + 3, _offset.size() - 2)];
+                for (uint32_t first = begin; first < end; first += max_batch_quads)
+                {
+                    _command.push_back(DrawCommand{ texture, first * 4, std::min(end - first, max_batch_quads) });
+                }
+                begin = end;
+            }
+        }
+        const Vertex* vertices() const noexcept { return _vertex.data(); }
+        size_t vertexCount() const noexcept { return _vertex.size(); }
+        size_t quadCount() const noexcept { return _count; }
+        const std::vector<DrawCommand>& commands() const noexcept { return _command; }
+    };
+}
@@ -0,0 +1,609 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+// portable reader for the page images written by fontatlas (png, bmp, dds) and a small png writer,
+// no platform image codec needed
+
+namespace fontatlas::runtime
+{
+    // 8 bit rgba, top to bottom
+    struct Image
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> pixels;
+        
+        void resize(uint32_t w, uint32_t h)
+        {
+            width = w;
+            height = h;
+            pixels.assign((size_t)w * h * 4, 0);
+        }
+        uint8_t* row(uint32_t y) { return pixels.data() + (size_t)y * width * 4; }
+        const uint8_t* row(uint32_t y) const { return pixels.data() + (size_t)y * width * 4; }
+    };
+    
+    namespace detail
+    {
+        inline uint32_t readBE32(const uint8_t* p)
+        {
+            return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+        }
+        inline uint32_t readLE32(const uint8_t* p)
+        {
+            return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | (uint32_t)p[0];
+        }
+        inline void writeBE32(std::string& out, uint32_t v)
+        {
+            out.push_back((char)(v >> 24));
+            out.push_back((char)(v >> 16));
+            out.push_back((char)(v >> 8));
+            out.push_back((char)v);
+        }
+        
+        // inflate (rfc 1951) with canonical huffman tables decoded one code length at a time
+        class Inflater
+        {
+        private:
+            struct Huffman
+            {
+                uint16_t count[16];
+                uint16_t symbol[288];
+            };
+            const uint8_t* _in;
+            size_t _size;
+            size_t _pos = 0;
+            uint32_t _bitbuf = 0;
+            uint32_t _bitcnt = 0;
+            bool _ok = true;
+            std::vector<uint8_t>& _out;
+        private:
+            uint32_t bits(uint32_t n)
+            {
+                while (_bitcnt < n)
+                {
+                    if (_pos >= _size)
+                    {
+                        _ok = false;
+                        return 0;
+                    }
+                    _bitbuf |= (uint32_t)_in[_pos++] << _bitcnt;
+                    _bitcnt += 8;
+                }
+                const uint32_t v = _bitbuf & ((1u << n) - 1);
+                _bitbuf >>= n;
+                _bitcnt -= n;
+                return v;
+            }
+            static bool build(Huffman& h, const uint8_t* length, uint32_t n)
+            {
+                std::memset(h.count, 0, sizeof(h.count));
+                for (uint32_t i = 0; i < n; i += 1)
+                {
+                    h.count[length[i]] += 1;
+                }
+                // offsets of each length in the symbol table, length 0 is not coded
+                uint16_t offset[16] = {};
+                for (uint32_t len = 1; len < 15; len += 1)
+                {
+                    offset[len + 1] = offset[len] + h.count[len];
+                }
+                for (uint32_t i = 0; i < n; i += 1)
+                {
+                    if (length[i] != 0)
+                    {
+                        h.symbol[offset[length[i]]++] = (uint16_t)i;
+                    }
+                }
+                return true;
+            }
+            int32_t decode(const Huffman& h)
+            {
+                int32_t code = 0;
+                int32_t first = 0;
+                int32_t index = 0;
+                for (uint32_t len = 1; len < 16; len += 1)
+                {
+                    code |= (int32_t)bits(1);
+                    const int32_t count = h.count[len];
+                    if (code - count < first)
+                    {
+                        return h.symbol[index + (code - first)];
+                    }
+                    index += count;
+                    first += count;
+                    first <<= 1;
+                    code <<= 1;
+                }
+                _ok = false;
+                return -1;
+            }
+            bool codes(const Huffman& lencode, const Huffman& distcode)
+            {
+                static constexpr uint16_t length_base[29] = {
+                    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+                static constexpr uint16_t length_extra[29] = {
+                    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+                static constexpr uint16_t dist_base[30] = {
+                    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+                static constexpr uint16_t dist_extra[30] = {
+                    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+                while (_ok)
+                {
+                    int32_t symbol = decode(lencode);
+                    if (symbol < 0)
+                    {
+                        return false;
+                    }
+                    if (symbol < 256)
+                    {
+                        _out.push_back((uint8_t)symbol);
+                    }
+                    else if (symbol == 256)
+                    {
+                        return true;
+                    }
+                    else
+                    {
+                        symbol -= 257;
+                        if (symbol >= 29)
+                        {
+                            return false;
+                        }
+                        const size_t len = length_base[symbol] + bits(length_extra[symbol]);
+                        const int32_t dsym = decode(distcode);
+                        if (dsym < 0 || dsym >= 30)
+                        {
+                            return false;
+                        }
+                        const size_t dist = dist_base[dsym] + bits(dist_extra[dsym]);
+                        if (dist > _out.size())
+                        {
+                            return false;
+                        }
+                        const size_t from = _out.size() - dist;
+                        for (size_t i = 0; i < len; i += 1)
+                        {
+                            _out.push_back(_out[from + i]);
+                        }
+                    }
+                }
+                return false;
+            }
+            bool stored()
+            {
+                _bitbuf = 0;
+                _bitcnt = 0;
+                if (_pos + 4 > _size)
+                {
+                    return false;
+                }
+                const uint32_t len = (uint32_t)_in[_pos] | ((uint32_t)_in[_pos + 1] << 8);
+                _pos += 4;
+                if (_pos + len > _size)
+                {
+                    return false;
+                }
+                _out.insert(_out.end(), _in + _pos, _in + _pos + len);
+                _pos += len;
+                return true;
+            }
+            bool fixed()
+            {
+                static Huffman lencode, distcode;
+                static bool ready = false;
+                if (!ready)
+                {
+                    uint8_t length[288];
+                    uint32_t i = 0;
+                    for (; i < 144; i += 1) length[i] = 8;
+                    for (; i < 256; i += 1) length[i] = 9;
+                    for (; i < 280; i += 1) length[i] = 7;
+                    for (; i < 288; i += 1) length[i] = 8;
+                    build(lencode, length, 288);
+                    for (i = 0; i < 30; i += 1) length[i] = 5;
+                    build(distcode, length, 30);
+                    ready = true;
+                }
+                return codes(lencode, distcode);
+            }
+            bool dynamic()
+            {
+                static constexpr uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+                const uint32_t nlen = bits(5) + 257;
+                const uint32_t ndist = bits(5) + 1;
+                const uint32_t ncode = bits(4) + 4;
+                if (nlen > 286 || ndist > 30)
+                {
+                    return false;
+                }
+                uint8_t length[320] = {};
+                for (uint32_t i = 0; i < ncode; i += 1)
+                {
+                    length[order[i]] = (uint8_t)bits(3);
+                }
+                Huffman lencode, distcode;
+                build(lencode, length, 19);
+                uint32_t index = 0;
+                while (_ok && index < nlen + ndist)
+                {
+                    const int32_t symbol = decode(lencode);
+                    if (symbol < 0)
+                    {
+                        return false;
+                    }
+                    if (symbol < 16)
+                    {
+                        length[index++] = (uint8_t)symbol;
+                        continue;
+                    }
+                    uint8_t value = 0;
+                    uint32_t repeat = 0;
+                    if (symbol == 16)
+                    {
+                        if (index == 0)
+                        {
+                            return false;
+                        }
+                        value = length[index - 1];
+                        repeat = 3 + bits(2);
+                    }
+                    else if (symbol == 17)
+                    {
+                        repeat = 3 + bits(3);
+                    }
+                    else
+                    {
+                        repeat = 11 + bits(7);
+                    }
+                    if (index + repeat > nlen + ndist)
+                    {
+                        return false;
+                    }
+                    while (repeat-- > 0)
+                    {
+                        length[index++] = value;
+                    }
+                }
+                build(lencode, length, nlen);
+                build(distcode, length + nlen, ndist);
+                return _ok && codes(lencode, distcode);
+            }
+        public:
+            bool run()
+            {
+                uint32_t last = 0;
+                do
+                {
+                    last = bits(1);
+                    const uint32_t type = bits(2);
+                    bool ok = false;
+                    switch (type)
+                    {
+                    case 0: ok = stored(); break;
+                    case 1: ok = fixed(); break;
+                    case 2: ok = dynamic(); break;
+                    default: break;
+                    }
+                    if (!ok || !_ok)
+                    {
+                        return false;
+                    }
+                } while (!last);
+                return true;
+            }
+            Inflater(const uint8_t* in, size_t size, std::vector<uint8_t>& out) : _in(in), _size(size), _out(out) {}
+        };
+        
+        inline uint32_t crc32(const uint8_t* p, size_t n, uint32_t crc = 0)
+        {
+            static uint32_t table[256] = {};
+            if (table[1] == 0)
+            {
+                for (uint32_t i = 0; i < 256; i += 1)
+                {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k += 1)
+                    {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    table[i] = c;
+                }
+            }
+            crc = ~crc;
+            for (size_t i = 0; i < n; i += 1)
+            {
+                crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+        
+        inline bool decodePNG(const std::vector<uint8_t>& data, Image& image)
+        {
+            static constexpr uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+            if (data.size() < 8 || std::memcmp(data.data(), signature, 8) != 0)
+            {
+                return false;
+            }
+            uint32_t width = 0, height = 0, channels = 0;
+            std::vector<uint8_t> idat;
+            std::vector<uint8_t> palette;
+            std::vector<uint8_t> palette_alpha;
+            uint8_t color_type = 0;
+            size_t pos = 8;
+            while (pos + 12 <= data.size())
+            {
+                const uint32_t len = readBE32(data.data() + pos);
+                const uint8_t* type = data.data() + pos + 4;
+                const uint8_t* body = data.data() + pos + 8;
+                if (pos + 12 + (size_t)len > data.size())
+                {
+                    return false;
+                }
+                if (std::memcmp(type, "IHDR", 4) == 0 && len >= 13)
+                {
+                    width = readBE32(body);
+                    height = readBE32(body + 4);
+                    const uint8_t depth = body[8];
+                    color_type = body[9];
+                    const uint8_t interlace = body[12];
+                    // fontatlas pages are always 8 bit and not interlaced
+                    if (depth != 8 || interlace != 0)
+                    {
+                        return false;
+                    }
+                    switch (color_type)
+                    {
+                    case 0: channels = 1; break;
+                    case 2: channels = 3; break;
+                    case 3: channels = 1; break;
+                    case 4: channels = 2; break;
+                    case 6: channels = 4; break;
+                    default: return false;
+                    }
+                }
+                else if (std::memcmp(type, "PLTE", 4) == 0)
+                {
+                    palette.assign(body, body + len);
+                }
+                else if (std::memcmp(type, "tRNS", 4) == 0)
+                {
+                    palette_alpha.assign(body, body + len);
+                }
+                else if (std::memcmp(type, "IDAT", 4) == 0)
+                {
+                    idat.insert(idat.end(), body, body + len);
+                }
+                else if (std::memcmp(type, "IEND", 4) == 0)
+                {
+                    break;
+                }
+                pos += 12 + (size_t)len;
+            }
+            if (width == 0 || height == 0 || channels == 0 || idat.size() < 2)
+            {
+                return false;
+            }
+            const size_t stride = (size_t)width * channels;
+            std::vector<uint8_t> raw;
+            raw.reserve((stride + 1) * height);
+            // skip the 2 byte zlib header, the adler32 trailer is not checked
+            Inflater inflater(idat.data() + 2, idat.size() - 2, raw);
+            if (!inflater.run() || raw.size() < (stride + 1) * height)
+            {
+                return false;
+            }
+            // undo the row filters in place
+            const uint32_t bpp = channels;
+            for (uint32_t y = 0; y < height; y += 1)
+            {
+                uint8_t* line = raw.data() + (stride + 1) * y;
+                const uint8_t filter = line[0];
+                uint8_t* cur = line + 1;
+                const uint8_t* prev = y > 0 ? raw.data() + (stride + 1) * (y - 1) + 1 : nullptr;
+                for (size_t x = 0; x < stride; x += 1)
+                {
+                    const int a = x >= bpp ? cur[x - bpp] : 0;
+                    const int b = prev ? prev[x] : 0;
+                    const int c = (prev && x >= bpp) ? prev[x - bpp] : 0;
+                    switch (filter)
+                    {
+                    case 0: break;
+                    case 1: cur[x] = (uint8_t)(cur[x] + a); break;
+                    case 2: cur[x] = (uint8_t)(cur[x] + b); break;
+                    case 3: cur[x] = (uint8_t)(cur[x] + ((a + b) >> 1)); break;
+                    case 4:
+                    {
+                        const int p = a + b - c;
+                        const int pa = p > a ? p - a : a - p;
+                        const int pb = p > b ? p - b : b - p;
+                        const int pc = p > c ? p - c : c - p;
+                        cur[x] = (uint8_t)(cur[x] + ((pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c)));
+                        break;
+                    }
+                    default: return false;
+                    }
+                }
+            }
+            image.resize(width, height);
+            for (uint32_t y = 0; y < height; y += 1)
+            {
+                const uint8_t* src = raw.data() + (stride + 1) * y + 1;
+                uint8_t* dst = image.row(y);
+                for (uint32_t x = 0; x < width; x += 1)
+                {
+                    switch (color_type)
+                    {
+                    case 0: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = 255; break;
+                    case 2: dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = 255; break;
+                    case 3:
+                    {
+                        const size_t i = src[0];
+                        dst[0] = i * 3 + 2 < palette.size() ? palette[i * 3] : 0;
+                        dst[1] = i * 3 + 2 < palette.size() ? palette[i * 3 + 1] : 0;
+                        dst[2] = i * 3 + 2 < palette.size() ? palette[i * 3 + 2] : 0;
+                        dst[3] = i < palette_alpha.size() ? palette_alpha[i] : 255;
+                        break;
+                    }
+                    case 4: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = src[1]; break;
+                    default: std::memcpy(dst, src, 4); break;
+                    }
+                    src += channels;
+                    dst += 4;
+                }
+            }
+            return true;
+        }
+        
+        // 32 bit bottom-up bgra, as written by Texture::_saveBMP
+        inline bool decodeBMP(const std::vector<uint8_t>& data, Image& image)
+        {
+            if (data.size() < 54 || data[0] != 'B' || data[1] != 'M')
+            {
+                return false;
+            }
+            const uint32_t offset = readLE32(data.data() + 10);
+            const int32_t width = (int32_t)readLE32(data.data() + 18);
+            const int32_t height = (int32_t)readLE32(data.data() + 22);
+            const uint16_t bit_count = (uint16_t)(data[28] | (data[29] << 8));
+            const uint32_t abs_height = height < 0 ? (uint32_t)-height : (uint32_t)height;
+            if (bit_count != 32 || width <= 0 || offset + (size_t)width * abs_height * 4 > data.size())
+            {
+                return false;
+            }
+            image.resize((uint32_t)width, abs_height);
+            for (uint32_t y = 0; y < abs_height; y += 1)
+            {
+                const uint32_t src_y = height < 0 ? y : abs_height - 1 - y;
+                const uint8_t* src = data.data() + offset + (size_t)src_y * width * 4;
+                uint8_t* dst = image.row(y);
+                for (int32_t x = 0; x < width; x += 1)
+                {
+                    dst[0] = src[2];
+                    dst[1] = src[1];
+                    dst[2] = src[0];
+                    dst[3] = src[3];
+                    src += 4;
+                    dst += 4;
+                }
+            }
+            return true;
+        }
+        
+        // uncompressed bgra8 top level, as written by Texture::_saveDDS
+        inline bool decodeDDS(const std::vector<uint8_t>& data, Image& image)
+        {
+            if (data.size() < 128 || std::memcmp(data.data(), "DDS ", 4) != 0)
+            {
+                return false;
+            }
+            const uint32_t height = readLE32(data.data() + 12);
+            const uint32_t width = readLE32(data.data() + 16);
+            const uint32_t bit_count = readLE32(data.data() + 88);
+            if (bit_count != 32 || 128 + (size_t)width * height * 4 > data.size())
+            {
+                return false;
+            }
+            image.resize(width, height);
+            const uint8_t* src = data.data() + 128;
+            uint8_t* dst = image.pixels.data();
+            for (size_t i = 0; i < (size_t)width * height; i += 1)
+            {
+                dst[0] = src[2];
+                dst[1] = src[1];
+                dst[2] = src[0];
+                dst[3] = src[3];
+                src += 4;
+                dst += 4;
+            }
+            return true;
+        }
+    }
+    
+    inline bool loadImage(const std::string& path, Image& image)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::in);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return detail::decodePNG(data, image) || detail::decodeBMP(data, image) || detail::decodeDDS(data, image);
+    }
+    
+    // rgba png with stored (uncompressed) deflate blocks, fast to write and readable by everything
+    inline bool savePNG(const std::string& path, const Image& image)
+    {
+        const size_t stride = (size_t)image.width * 4 + 1;
+        std::vector<uint8_t> raw(stride * image.height);
+        for (uint32_t y = 0; y < image.height; y += 1)
+        {
+            raw[stride * y] = 0;
+            std::memcpy(raw.data() + stride * y + 1, image.row(y), stride - 1);
+        }
+        std::string zlib;
+        zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+        zlib.push_back((char)0x78);
+        zlib.push_back((char)0x01);
+        for (size_t pos = 0; pos < raw.size() || pos == 0; )
+        {
+            const size_t n = std::min<size_t>(raw.size() - pos, 65535);
+            const bool last = pos + n >= raw.size();
+            zlib.push_back((char)(last ? 1 : 0));
+            zlib.push_back((char)(n & 0xFF));
+            zlib.push_back((char)(n >> 8));
+            zlib.push_back((char)(~n & 0xFF));
+            zlib.push_back((char)((~n >> 8) & 0xFF));
+            zlib.append((const char*)raw.data() + pos, n);
+            pos += n;
+            if (last)
+            {
+                break;
+            }
+        }
+        uint32_t s1 = 1, s2 = 0;
+        for (size_t i = 0; i < raw.size(); i += 1)
+        {
+            s1 = (s1 + raw[i]) % 65521;
+            s2 = (s2 + s1) % 65521;
+        }
+        detail::writeBE32(zlib, (s2 << 16) | s1);
+        
+        std::string out("\x89PNG\r\n\x1A\n", 8);
+        auto chunk = [&](const char* type, const std::string& body)
+        {
+            detail::writeBE32(out, (uint32_t)body.size());
+            const size_t begin = out.size();
+            out.append(type, 4);
+            out += body;
+            detail::writeBE32(out, detail::crc32((const uint8_t*)out.data() + begin, out.size() - begin));
+        };
+        std::string ihdr;
+        detail::writeBE32(ihdr, image.width);
+        detail::writeBE32(ihdr, image.height);
+        ihdr += std::string("\x08\x06\x00\x00\x00", 5);
+        chunk("IHDR", ihdr);
+        chunk("IDAT", zlib);
+        chunk("IEND", std::string());
+        
+        std::ofstream file(path, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        file.write(out.data(), (std::streamsize)out.size());
+        return file.good();
+    }
+}
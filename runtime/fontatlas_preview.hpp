@@ -0,0 +1,152 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "fontatlas_runtime.hpp"
+#include "fontatlas_batch.hpp"
+#include "fontatlas_image.hpp"
+
+// software compositor for batched text, renders without a gpu for previews and build checks
+
+namespace fontatlas::runtime
+{
+    class PreviewRenderer
+    {
+    private:
+        std::vector<Image> _page; // texture - 1
+    private:
+        // median of rgb, the msdf distance
+        static inline float median(const uint8_t* p)
+        {
+            return (float)std::max(std::min(p[0], p[1]), std::min(std::max(p[0], p[1]), p[2]));
+        }
+    public:
+        // decode every page of the atlas, pages are kept in rgba
+        bool load(const Atlas& atlas)
+        {
+            _page.clear();
+            _page.resize(atlas.textureCount());
+            for (uint32_t i = 0; i < atlas.textureCount(); i += 1)
+            {
+                if (!loadImage(atlas.texturePath(i + 1), _page[i]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        const Image* page(uint32_t texture) const
+        {
+            return (texture >= 1 && texture <= _page.size()) ? &_page[texture - 1] : nullptr;
+        }
+        // composite the quads of a finished batch over canvas, all quads must come from font,
+        // uv are expected in texel (setTextureSize not called) or normalized to the page size
+        void draw(const TextBatch& batch, const Font& font, Image& canvas, float scale = 1.0f, bool normalized_uv = false) const
+        {
+            const bool sdf = font.image_mode == "sdf";
+            const bool msdf = font.image_mode == "msdf";
+            // distance stored as 0.5 + 0.5 * d / spread, d in pixel of the atlas and positive inside
+            const float spread = font.spread > 0.0f ? font.spread : 1.0f;
+            const float sharpness = 2.0f * spread * scale;
+            const Vertex* vertex = batch.vertices();
+            for (auto& cmd : batch.commands())
+            {
+                const Image* page_image = page(cmd.texture);
+                if (page_image == nullptr || page_image->width == 0)
+                {
+                    continue;
+                }
+                const float us = normalized_uv ? (float)page_image->width : 1.0f;
+                const float vs = normalized_uv ? (float)page_image->height : 1.0f;
+                for (uint32_t q = 0; q < cmd.quad_count; q += 1)
+                {
+                    const Vertex* v = vertex + cmd.first_vertex + (size_t)q * 4;
+                    // vertex 0 is the top left corner, 2 the bottom right
+                    const float x0 = v[0].x, y0 = v[0].y, x1 = v[2].x, y1 = v[2].y;
+                    if (x1 <= x0 || y1 <= y0)
+                    {
+                        continue;
+                    }
+                    const float u0 = v[0].u * us, v0 = v[0].v * vs;
+                    const float du = (v[2].u * us - u0) / (x1 - x0);
+                    const float dv = (v[2].v * vs - v0) / (y1 - y0);
+                    const uint32_t mask = v[0].channel;
+                    const uint32_t channel = mask == 0x00FF0000 ? 0 : mask == 0x0000FF00 ? 1 : mask == 0x000000FF ? 2 : 3;
+                    const uint32_t color = v[0].color;
+                    const float cr = (float)((color >> 16) & 0xFF);
+                    const float cg = (float)((color >> 8) & 0xFF);
+                    const float cb = (float)(color & 0xFF);
+                    const float ca = (float)(color >> 24) * (1.0f / 255.0f);
+                    const int32_t px0 = std::max((int32_t)std::floor(x0), 0);
+                    const int32_t py0 = std::max((int32_t)std::floor(y0), 0);
+                    const int32_t px1 = std::min((int32_t)std::ceil(x1), (int32_t)canvas.width);
+                    const int32_t py1 = std::min((int32_t)std::ceil(y1), (int32_t)canvas.height);
+                    const float max_x = (float)page_image->width - 1.0f;
+                    const float max_y = (float)page_image->height - 1.0f;
+                    for (int32_t py = py0; py < py1; py += 1)
+                    {
+                        // bilinear, texel centers at half integers, clamped to the page
+                        const float fy = std::clamp(v0 + ((float)py + 0.5f - y0) * dv - 0.5f, 0.0f, max_y);
+                        const uint32_t ty0 = (uint32_t)fy;
+                        const float ty = fy - (float)ty0;
+                        const uint8_t* row0 = page_image->row(ty0);
+                        const uint8_t* row1 = page_image->row(std::min(ty0 + 1, page_image->height - 1));
+                        uint8_t* dst = canvas.row((uint32_t)py) + (size_t)px0 * 4;
+                        for (int32_t px = px0; px < px1; px += 1, dst += 4)
+                        {
+                            const float fx = std::clamp(u0 + ((float)px + 0.5f - x0) * du - 0.5f, 0.0f, max_x);
+                            const uint32_t tx0 = (uint32_t)fx;
+                            const float tx = fx - (float)tx0;
+                            const size_t i0 = (size_t)tx0 * 4;
+                            const size_t i1 = (size_t)std::min(tx0 + 1, page_image->width - 1) * 4;
+                            float t00, t10, t01, t11;
+                            if (msdf)
+                            {
+                                t00 = median(row0 + i0);
+                                t10 = median(row0 + i1);
+                                t01 = median(row1 + i0);
+                                t11 = median(row1 + i1);
+                            }
+                            else
+                            {
+                                t00 = (float)row0[i0 + channel];
+                                t10 = (float)row0[i1 + channel];
+                                t01 = (float)row1[i0 + channel];
+                                t11 = (float)row1[i1 + channel];
+                            }
+                            const float top = t00 + (t10 - t00) * tx;
+                            const float bottom = t01 + (t11 - t01) * tx;
+                            float coverage = (top + (bottom - top) * ty) * (1.0f / 255.0f);
+                            if (sdf || msdf)
+                            {
+                                coverage = std::clamp((coverage - 0.5f) * sharpness + 0.5f, 0.0f, 1.0f);
+                            }
+                            const float a = coverage * ca;
+                            if (a <= 0.0f)
+                            {
+                                continue;
+                            }
+                            if (dst[3] == 0)
+                            {
+                                dst[0] = (uint8_t)cr;
+                                dst[1] = (uint8_t)cg;
+                                dst[2] = (uint8_t)cb;
+                                dst[3] = (uint8_t)(a * 255.0f + 0.5f);
+                                continue;
+                            }
+                            // source over, canvas is straight alpha
+                            const float da = (float)dst[3] * (1.0f / 255.0f);
+                            const float oa = a + da * (1.0f - a);
+                            const float k = da * (1.0f - a);
+                            dst[0] = (uint8_t)((cr * a + (float)dst[0] * k) / oa + 0.5f);
+                            dst[1] = (uint8_t)((cg * a + (float)dst[1] * k) / oa + 0.5f);
+                            dst[2] = (uint8_t)((cb * a + (float)dst[2] * k) / oa + 0.5f);
+                            dst[3] = (uint8_t)(oa * 255.0f + 0.5f);
+                        }
+                    }
+                }
+            }
+        }
+    };
+}
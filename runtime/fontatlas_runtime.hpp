@@ -0,0 +1,620 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iterator>
+
+// header-only loader for the index.lua written by fontatlas, no lua and no freetype needed at runtime
+
+namespace fontatlas::runtime
+{
+    constexpr uint32_t invalid_glyph = 0xFFFFFFFF;
+    constexpr uint32_t max_code = 0x110000;
+    
+    struct Rect
+    {
+        float x;
+        float y;
+        float width;
+        float height;
+    };
+    
+    struct Pen
+    {
+        float x;
+        float y;
+        float advance;
+    };
+    
+    // one glyph, assembled from the columns of a GlyphTable
+    struct Glyph
+    {
+        uint32_t code;
+        uint32_t texture; // 1-based page number, the same as the image file name
+        uint32_t channel; // 0 r 1 g 2 b 3 a
+        Rect uv;          // in texel
+        float draw_width;
+        float draw_height;
+        Pen horizontal;
+        Pen vertical;
+    };
+    
+    // glyphs stored by column, looked up through a two-level code point page table
+    class GlyphTable
+    {
+    private:
+        static constexpr uint32_t page_bits = 8;
+        static constexpr uint32_t page_size = 1u << page_bits;
+        std::vector<uint16_t> _directory; // max_code / page_size entries, 0 is the empty page
+        std::vector<uint32_t> _page;      // page_size entries per page
+        std::vector<uint32_t> _code;
+        std::vector<uint16_t> _texture;
+        std::vector<uint8_t> _channel;
+        std::vector<Rect> _uv;
+        std::vector<float> _draw; // width, height
+        std::vector<Pen> _horizontal;
+        std::vector<Pen> _vertical;
+    public:
+        // index of the glyph, invalid_glyph if the code point is not in the table
+        uint32_t find(uint32_t code) const noexcept
+        {
+            if (code >= max_code || _directory.empty())
+            {
+                return invalid_glyph;
+            }
+            return _page[((size_t)_directory[code >> page_bits] << page_bits) | (code & (page_size - 1))];
+        }
+        bool find(uint32_t code, Glyph& glyph) const noexcept
+        {
+            const uint32_t index = find(code);
+            if (index == invalid_glyph)
+            {
+                return false;
+            }
+            glyph = at(index);
+            return true;
+        }
+        Glyph at(uint32_t index) const noexcept
+        {
+            Glyph glyph;
+            glyph.code = _code[index];
+            glyph.texture = _texture[index];
+            glyph.channel = _channel[index];
+            glyph.uv = _uv[index];
+            glyph.draw_width = _draw[index * 2];
+            glyph.draw_height = _draw[index * 2 + 1];
+            glyph.horizontal = _horizontal[index];
+            glyph.vertical = _vertical[index];
+            return glyph;
+        }
+        size_t size() const noexcept { return _code.size(); }
+        bool empty() const noexcept { return _code.empty(); }
+        const uint32_t* code() const noexcept { return _code.data(); }
+        const uint16_t* texture() const noexcept { return _texture.data(); }
+        const uint8_t* channel() const noexcept { return _channel.data(); }
+        const Rect* uv() const noexcept { return _uv.data(); }
+        const float* draw() const noexcept { return _draw.data(); }
+        const Pen* horizontal() const noexcept { return _horizontal.data(); }
+        const Pen* vertical() const noexcept { return _vertical.data(); }
+    public:
+        // values in index order: texture, channel, uv x y w h, draw w h, h pen x y advance, v pen x y advance
+        void push(uint32_t code, const float* v)
+        {
+            _code.push_back(code);
+            _texture.push_back((uint16_t)v[0]);
+            _channel.push_back((uint8_t)v[1]);
+            _uv.push_back(Rect{ v[2], v[3], v[4], v[5] });
+            _draw.push_back(v[6]);
+            _draw.push_back(v[7]);
+            _horizontal.push_back(Pen{ v[8], v[9], v[10] });
+            _vertical.push_back(Pen{ v[11], v[12], v[13] });
+        }
+        void build()
+        {
+            _directory.assign(max_code >> page_bits, 0);
+            _page.assign(page_size, invalid_glyph);
+            for (uint32_t i = 0; i < (uint32_t)_code.size(); i += 1)
+            {
+                const uint32_t code = _code[i];
+                if (code >= max_code)
+                {
+                    continue;
+                }
+                uint16_t& page = _directory[code >> page_bits];
+                if (page == 0)
+                {
+                    page = (uint16_t)(_page.size() >> page_bits);
+                    _page.resize(_page.size() + page_size, invalid_glyph);
+                }
+                _page[((size_t)page << page_bits) | (code & (page_size - 1))] = i;
+            }
+        }
+    };
+    
+    struct KerningPair
+    {
+        uint32_t first;
+        uint32_t second;
+        float advance; // in pixel
+    };
+    
+    struct Font
+    {
+        std::string name;
+        uint32_t size = 0; // pixel size for fonts built with several sizes, 0 otherwise
+        bool multi_channel = false;
+        std::string image_mode = "normal";
+        float spread = 0.0f;
+        float ascender = 0.0f;
+        float descender = 0.0f;
+        float height = 0.0f;
+        float max_advance = 0.0f;
+        GlyphTable glyphs;
+        GlyphTable stroke;
+        GlyphTable shadow;
+        std::vector<KerningPair> kerning; // sorted by first then second
+        
+        float kern(uint32_t first, uint32_t second) const noexcept
+        {
+            auto it = std::lower_bound(kerning.begin(), kerning.end(), KerningPair{ first, second, 0.0f },
+                [](const KerningPair& a, const KerningPair& b)
+                {
+                    return a.first != b.first ? a.first < b.first : a.second < b.second;
+                });
+            return (it != kerning.end() && it->first == first && it->second == second) ? it->advance : 0.0f;
+        }
+    };
+    
+    class Atlas
+    {
+    private:
+        // recursive descent parser for the lua subset written by the generator
+        class Parser
+        {
+        private:
+            const char* _p;
+            const char* _end;
+            bool _ok = true;
+        public:
+            bool ok() const { return _ok; }
+            bool done()
+            {
+                space();
+                return _p >= _end;
+            }
+            void space()
+            {
+                while (_p < _end)
+                {
+                    if (*_p == ' ' || *_p == '\t' || *_p == '\r' || *_p == '\n')
+                    {
+                        _p += 1;
+                    }
+                    else if (_end - _p >= 2 && _p[0] == '-' && _p[1] == '-')
+                    {
+                        while (_p < _end && *_p != '\n')
+                        {
+                            _p += 1;
+                        }
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+            }
+            bool accept(char c)
+            {
+                space();
+                if (_p < _end && *_p == c)
+                {
+                    _p += 1;
+                    return true;
+                }
+                return false;
+            }
+            bool expect(char c)
+            {
+                if (!accept(c))
+                {
+                    _ok = false;
+                }
+                return _ok;
+            }
+            bool peek(char c)
+            {
+                space();
+                return _p < _end && *_p == c;
+            }
+            std::string_view name()
+            {
+                space();
+                const char* begin = _p;
+                while (_p < _end && (*_p == '_' || (*_p >= 'a' && *_p <= 'z') || (*_p >= 'A' && *_p <= 'Z')
+                    || (_p != begin && *_p >= '0' && *_p <= '9')))
+                {
+                    _p += 1;
+                }
+                if (_p == begin)
+                {
+                    _ok = false;
+                }
+                return std::string_view(begin, (size_t)(_p - begin));
+            }
+            double number()
+            {
+                space();
+                double v = 0.0;
+                const char* begin = _p;
+                if (begin < _end && *begin == '+')
+                {
+                    begin += 1;
+                }
+                auto r = std::from_chars(begin, _end, v);
+                if (r.ec != std::errc())
+                {
+                    _ok = false;
+                    return 0.0;
+                }
+                _p = r.ptr;
+                return v;
+            }
+            std::string string()
+            {
+                std::string s;
+                if (!expect('"'))
+                {
+                    return s;
+                }
+                while (_p < _end && *_p != '"')
+                {
+                    if (*_p == '\\' && _p + 1 < _end)
+                    {
+                        _p += 1;
+                    }
+                    s.push_back(*_p);
+                    _p += 1;
+                }
+                expect('"');
+                return s;
+            }
+            bool boolean()
+            {
+                const std::string_view v = name();
+                return v == "true";
+            }
+            void skip()
+            {
+                space();
+                if (_p >= _end)
+                {
+                    _ok = false;
+                }
+                else if (*_p == '{')
+                {
+                    table([&](Parser& p, bool, std::string_view, double) { p.skip(); });
+                }
+                else if (*_p == '"')
+                {
+                    string();
+                }
+                else if (*_p == '-' || *_p == '+' || *_p == '.' || (*_p >= '0' && *_p <= '9'))
+                {
+                    number();
+                }
+                else
+                {
+                    name();
+                }
+            }
+            // fn(parser, is_name, name, number_key) for each field, the field value must be consumed by fn,
+            // array items have is_name false and number_key 0
+            template<typename F>
+            void table(F&& fn)
+            {
+                if (!expect('{'))
+                {
+                    return;
+                }
+                while (_ok && !accept('}'))
+                {
+                    space();
+                    if (accept('['))
+                    {
+                        double key = 0.0;
+                        std::string key_string;
+                        const bool is_string = peek('"');
+                        if (is_string)
+                        {
+                            key_string = string();
+                        }
+                        else
+                        {
+                            key = number();
+                        }
+                        expect(']');
+                        expect('=');
+                        fn(*this, is_string, std::string_view(key_string), key);
+                    }
+                    else if (_p < _end && (*_p == '_' || (*_p >= 'a' && *_p <= 'z') || (*_p >= 'A' && *_p <= 'Z'))
+                        && !(name_ahead("true") || name_ahead("false")))
+                    {
+                        const std::string_view key = name();
+                        expect('=');
+                        fn(*this, true, key, 0.0);
+                    }
+                    else
+                    {
+                        fn(*this, false, std::string_view(), 0.0);
+                    }
+                    if (!accept(','))
+                    {
+                        accept(';');
+                    }
+                }
+            }
+            bool name_ahead(std::string_view v)
+            {
+                return (size_t)(_end - _p) >= v.size() && std::string_view(_p, v.size()) == v
+                    && ((size_t)(_end - _p) == v.size() || !(std::isalnum((unsigned char)_p[v.size()]) || _p[v.size()] == '_'));
+            }
+        public:
+            Parser(const char* p, size_t n) : _p(p), _end(p + n) {}
+        };
+    private:
+        std::vector<Font> _font;
+        uint32_t _textures = 0;
+        uint32_t _texture_width = 0;
+        uint32_t _texture_height = 0;
+        uint32_t _mip_levels = 0;
+        std::string _image_format = "png";
+        std::string _directory;
+    private:
+        static void parseGlyphs(Parser& p, GlyphTable& table)
+        {
+            p.table([&](Parser& p, bool is_name, std::string_view, double key)
+            {
+                if (is_name)
+                {
+                    p.skip();
+                    return;
+                }
+                float v[14] = {};
+                uint32_t n = 0;
+                p.table([&](Parser& p, bool, std::string_view, double)
+                {
+                    const float x = (float)p.number();
+                    if (n < 14)
+                    {
+                        v[n++] = x;
+                    }
+                });
+                table.push((uint32_t)key, v);
+            });
+        }
+        // fields shared by single size fonts and the size blocks of multi-size fonts
+        static bool parseField(Parser& p, std::string_view key, Font& font)
+        {
+            if (key == "multi_channel") font.multi_channel = p.boolean();
+            else if (key == "image_mode") font.image_mode = p.string();
+            else if (key == "spread") font.spread = (float)p.number();
+            else if (key == "ascender") font.ascender = (float)p.number();
+            else if (key == "descender") font.descender = (float)p.number();
+            else if (key == "height") font.height = (float)p.number();
+            else if (key == "max_advance") font.max_advance = (float)p.number();
+            else if (key == "stroke") parseGlyphs(p, font.stroke);
+            else if (key == "shadow") parseGlyphs(p, font.shadow);
+            else if (key == "kerning")
+            {
+                float v[3] = {};
+                uint32_t n = 0;
+                p.table([&](Parser& p, bool, std::string_view, double)
+                {
+                    v[n++] = (float)p.number();
+                    if (n == 3)
+                    {
+                        font.kerning.push_back(KerningPair{ (uint32_t)v[0], (uint32_t)v[1], v[2] });
+                        n = 0;
+                    }
+                });
+            }
+            else return false;
+            return true;
+        }
+        void parseFont(Parser& p, const std::string& name)
+        {
+            Font base;
+            base.name = name;
+            bool multi_size = false;
+            p.table([&](Parser& p, bool is_name, std::string_view key, double code)
+            {
+                if (!is_name)
+                {
+                    // glyph of a single size font
+                    float v[14] = {};
+                    uint32_t n = 0;
+                    p.table([&](Parser& p, bool, std::string_view, double)
+                    {
+                        const float x = (float)p.number();
+                        if (n < 14)
+                        {
+                            v[n++] = x;
+                        }
+                    });
+                    base.glyphs.push((uint32_t)code, v);
+                }
+                else if (key == "size")
+                {
+                    multi_size = true;
+                    p.table([&](Parser& p, bool, std::string_view, double size)
+                    {
+                        Font font = base;
+                        font.size = (uint32_t)size;
+                        p.table([&](Parser& p, bool is_name, std::string_view key, double code)
+                        {
+                            if (!is_name)
+                            {
+                                float v[14] = {};
+                                uint32_t n = 0;
+                                p.table([&](Parser& p, bool, std::string_view, double)
+                                {
+                                    const float x = (float)p.number();
+                                    if (n < 14)
+                                    {
+                                        v[n++] = x;
+                                    }
+                                });
+                                font.glyphs.push((uint32_t)code, v);
+                            }
+                            else if (!parseField(p, key, font))
+                            {
+                                p.skip();
+                            }
+                        });
+                        _font.push_back(std::move(font));
+                    });
+                }
+                else if (!parseField(p, key, base))
+                {
+                    p.skip();
+                }
+            });
+            if (!multi_size)
+            {
+                _font.push_back(std::move(base));
+            }
+        }
+    public:
+        bool load(std::string_view text)
+        {
+            clear();
+            Parser p(text.data(), text.size());
+            while (p.ok() && !p.done())
+            {
+                const std::string_view word = p.name();
+                if (word == "local")
+                {
+                    // local font = {}
+                    p.name();
+                    p.expect('=');
+                    p.skip();
+                }
+                else if (word == "return")
+                {
+                    p.name();
+                    break;
+                }
+                else if (p.accept('.'))
+                {
+                    const std::string_view key = p.name();
+                    p.expect('=');
+                    if (key == "textures") _textures = (uint32_t)p.number();
+                    else if (key == "texture_size")
+                    {
+                        uint32_t n = 0;
+                        p.table([&](Parser& p, bool, std::string_view, double)
+                        {
+                            const uint32_t v = (uint32_t)p.number();
+                            if (n == 0) _texture_width = v;
+                            else if (n == 1) _texture_height = v;
+                            n += 1;
+                        });
+                    }
+                    else if (key == "mip_levels") _mip_levels = (uint32_t)p.number();
+                    else if (key == "image_format") _image_format = p.string();
+                    else p.skip();
+                }
+                else if (p.accept('['))
+                {
+                    const std::string name = p.string();
+                    p.expect(']');
+                    p.expect('=');
+                    parseFont(p, name);
+                }
+                else
+                {
+                    p.skip();
+                }
+            }
+            if (!p.ok())
+            {
+                clear();
+                return false;
+            }
+            for (auto& font : _font)
+            {
+                font.glyphs.build();
+                font.stroke.build();
+                font.shadow.build();
+            }
+            return true;
+        }
+        bool loadFile(const std::string& path)
+        {
+            std::ifstream file(path, std::ios::binary | std::ios::in);
+            if (!file.is_open())
+            {
+                return false;
+            }
+            const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            const size_t slash = path.find_last_of("/\\");
+            const std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+            if (!load(text))
+            {
+                return false;
+            }
+            _directory = directory;
+            return true;
+        }
+        void clear()
+        {
+            _font.clear();
+            _textures = 0;
+            _texture_width = 0;
+            _texture_height = 0;
+            _mip_levels = 0;
+            _image_format = "png";
+            _directory.clear();
+        }
+        // size 0 matches any size of the font
+        const Font* font(std::string_view name, uint32_t size = 0) const noexcept
+        {
+            for (auto& v : _font)
+            {
+                if (v.name == name && (size == 0 || v.size == 0 || v.size == size))
+                {
+                    return &v;
+                }
+            }
+            return nullptr;
+        }
+        const Font* find(const Font* font, uint32_t code, Glyph& glyph) const noexcept
+        {
+            return (font && font->glyphs.find(code, glyph)) ? font : nullptr;
+        }
+        const std::vector<Font>& fonts() const noexcept { return _font; }
+        uint32_t textureCount() const noexcept { return _textures; }
+        // page size in texel, 0 for indices written before it was recorded
+        uint32_t textureWidth() const noexcept { return _texture_width; }
+        uint32_t textureHeight() const noexcept { return _texture_height; }
+        uint32_t mipLevels() const noexcept { return _mip_levels; }
+        const std::string& imageFormat() const noexcept { return _image_format; }
+        // image file of a page, next to the index file, dds keeps the mip chain in one file
+        std::string texturePath(uint32_t texture, uint32_t level = 0) const
+        {
+            std::string path = _directory + std::to_string(texture);
+            if (level > 0 && _image_format != "dds")
+            {
+                path += "_mip" + std::to_string(level);
+            }
+            return path + "." + _image_format;
+        }
+    };
+}
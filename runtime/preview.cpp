@@ -0,0 +1,158 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include "fontatlas_runtime.hpp"
+#include "fontatlas_batch.hpp"
+#include "fontatlas_image.hpp"
+#include "fontatlas_preview.hpp"
+
+// headless preview: lay out text with a generated atlas and write the result to a png
+//
+// fontatlas_preview <index.lua> <font> <output.png> <text | @lines.txt> [options]
+//   --size <px>     size of a font built with several sizes, the first one by default
+//   --scale <s>     draw scale, distance field atlases stay sharp when scaled up
+//   --color <argb>  text color in hex, ffffffff by default
+//   --bench <n>     lay out and composite every line n more times and report the throughput
+
+namespace
+{
+    using clock_ = std::chrono::steady_clock;
+    
+    bool readLines(const std::string& path, std::vector<std::string>& lines)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::in);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            lines.push_back(std::move(line));
+        }
+        // skip the utf-8 bom
+        if (!lines.empty() && lines[0].size() >= 3 && std::memcmp(lines[0].data(), "\xEF\xBB\xBF", 3) == 0)
+        {
+            lines[0].erase(0, 3);
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    using namespace fontatlas::runtime;
+    
+    if (argc < 5)
+    {
+        std::printf("usage: fontatlas_preview <index.lua> <font> <output.png> <text | @lines.txt>"
+            " [--size px] [--scale s] [--color argb] [--bench n]\n");
+        return 1;
+    }
+    uint32_t size = 0;
+    float scale = 1.0f;
+    uint32_t color = 0xFFFFFFFF;
+    uint32_t bench = 0;
+    for (int i = 5; i + 1 < argc; i += 2)
+    {
+        if (std::strcmp(argv[i], "--size") == 0) size = (uint32_t)std::strtoul(argv[i + 1], nullptr, 10);
+        else if (std::strcmp(argv[i], "--scale") == 0) scale = std::max((float)std::atof(argv[i + 1]), 0.01f);
+        else if (std::strcmp(argv[i], "--color") == 0) color = (uint32_t)std::strtoul(argv[i + 1], nullptr, 16);
+        else if (std::strcmp(argv[i], "--bench") == 0) bench = (uint32_t)std::strtoul(argv[i + 1], nullptr, 10);
+    }
+    
+    Atlas atlas;
+    if (!atlas.loadFile(argv[1]))
+    {
+        std::printf("can not load %s\n", argv[1]);
+        return 1;
+    }
+    const Font* font = atlas.font(argv[2], size);
+    if (font == nullptr)
+    {
+        std::printf("font \"%s\" not found\n", argv[2]);
+        return 1;
+    }
+    PreviewRenderer renderer;
+    if (!renderer.load(atlas))
+    {
+        std::printf("can not load the pages of %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<std::string> lines;
+    if (argv[4][0] == '@')
+    {
+        if (!readLines(argv[4] + 1, lines))
+        {
+            std::printf("can not open %s\n", argv[4] + 1);
+            return 1;
+        }
+    }
+    else
+    {
+        lines.emplace_back(argv[4]);
+    }
+    
+    // one line per row, baseline at the ascender
+    const float line_height = std::ceil((font->height > 0.0f ? font->height : font->ascender - font->descender) * scale);
+    const float margin = 4.0f;
+    TextBatch batch;
+    auto layout = [&]()
+    {
+        batch.clear();
+        float y = margin + std::ceil(font->ascender * scale);
+        for (auto& line : lines)
+        {
+            batch.addText(*font, line, margin, y, color, scale);
+            y += line_height;
+        }
+        batch.finish();
+    };
+    layout();
+    float right = 0.0f;
+    for (size_t i = 0; i < batch.vertexCount(); i += 1)
+    {
+        right = std::max(right, batch.vertices()[i].x);
+    }
+    Image canvas;
+    canvas.resize((uint32_t)std::ceil(right + margin), (uint32_t)(line_height * (float)lines.size() + 2.0f * margin));
+    renderer.draw(batch, *font, canvas, scale);
+    if (!savePNG(argv[3], canvas))
+    {
+        std::printf("can not write %s\n", argv[3]);
+        return 1;
+    }
+    std::printf("%s: %ux%u, %zu lines, %zu glyphs\n", argv[3], canvas.width, canvas.height, lines.size(), batch.quadCount());
+    
+    if (bench > 0)
+    {
+        double layout_ms = 0.0;
+        double draw_ms = 0.0;
+        for (uint32_t i = 0; i < bench; i += 1)
+        {
+            auto begin = clock_::now();
+            layout();
+            auto middle = clock_::now();
+            std::fill(canvas.pixels.begin(), canvas.pixels.end(), (uint8_t)0);
+            renderer.draw(batch, *font, canvas, scale);
+            auto end = clock_::now();
+            layout_ms += std::chrono::duration<double, std::milli>(middle - begin).count();
+            draw_ms += std::chrono::duration<double, std::milli>(end - middle).count();
+        }
+        const double strings = (double)lines.size() * bench;
+        const double glyphs = (double)batch.quadCount() * bench;
+        std::printf("layout: %.3f ms, %.1f strings/ms, %.1f glyphs/ms\n", layout_ms, strings / layout_ms, glyphs / layout_ms);
+        std::printf("composite: %.3f ms, %.1f strings/ms, %.1f glyphs/ms\n", draw_ms, strings / draw_ms, glyphs / draw_ms);
+    }
+    return 0;
+}
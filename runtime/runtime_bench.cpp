@@ -0,0 +1,171 @@
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include "fontatlas_runtime.hpp"
+#include "fontatlas_batch.hpp"
+
+// load time, lookup and text batching throughput of the runtime on a generated index,
+// pass an index.lua path to measure a real atlas instead
+
+namespace
+{
+    using clock_ = std::chrono::steady_clock;
+    
+    double elapsedMs(clock_::time_point begin)
+    {
+        return std::chrono::duration<double, std::milli>(clock_::now() - begin).count();
+    }
+    
+    // same layout as the index written by the builder, cjk codes so the pages are dense
+    std::string makeIndex(uint32_t glyphs)
+    {
+        std::string text;
+        text.reserve((size_t)glyphs * 96);
+        text += "local font = {}\nfont.textures=8\nfont.texture_size={2048,1024}\nfont.mip_levels=0\n";
+        text += "font[\"bench\"] = {\n  multi_channel=true,\n  image_mode=\"normal\",\n  spread=0,\n";
+        text += "  ascender=28,\n  descender=-8,\n  height=36,\n  max_advance=32,\n";
+        char buffer[256] = {};
+        for (uint32_t i = 0; i < glyphs; i += 1)
+        {
+            const uint32_t code = 0x4E00 + i;
+            int n = std::snprintf(buffer, 256,
+                "  [%u]={%u,%u,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g},\n",
+                code, 1 + i / 4096, i % 4, (float)(i % 64) * 32.0f, (float)((i / 64) % 32) * 32.0f, 30.0f, 31.0f,
+                30.0f, 31.0f, 1.0f, 27.0f, 32.0f, -15.0f, -1.0f, 32.0f);
+            text.append(buffer, (size_t)n);
+        }
+        text += "}\nreturn font\n";
+        return text;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    using namespace fontatlas::runtime;
+    
+    std::string text;
+    if (argc > 1)
+    {
+        std::FILE* file = std::fopen(argv[1], "rb");
+        if (!file)
+        {
+            std::printf("can not open %s\n", argv[1]);
+            return 1;
+        }
+        char buffer[65536];
+        size_t n = 0;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+        {
+            text.append(buffer, n);
+        }
+        std::fclose(file);
+    }
+    else
+    {
+        text = makeIndex(30000);
+    }
+    
+    // load, best of several runs
+    Atlas atlas;
+    double load_ms = 1e30;
+    for (int run = 0; run < 5; run += 1)
+    {
+        auto begin = clock_::now();
+        if (!atlas.load(text))
+        {
+            std::printf("failed to parse the index\n");
+            return 1;
+        }
+        load_ms = std::min(load_ms, elapsedMs(begin));
+    }
+    if (atlas.fonts().empty())
+    {
+        std::printf("no font in the index\n");
+        return 1;
+    }
+    const Font& font = atlas.fonts()[0];
+    std::printf("font \"%s\": %zu glyphs, %u textures, %.1f KiB index\n",
+        font.name.c_str(), font.glyphs.size(), atlas.textureCount(), (double)text.size() / 1024.0);
+    std::printf("load: %.3f ms\n", load_ms);
+    
+    // random lookups, mostly hits with some misses
+    const uint32_t lookups = 10000000;
+    std::vector<uint32_t> codes(1 << 16);
+    std::mt19937 rng(42);
+    for (auto& v : codes)
+    {
+        v = (rng() % 8 == 0) ? rng() % 0x30000 : font.glyphs.code()[rng() % font.glyphs.size()];
+    }
+    uint64_t found = 0;
+    float sum = 0.0f;
+    auto begin = clock_::now();
+    for (uint32_t i = 0; i < lookups; i += 1)
+    {
+        const uint32_t index = font.glyphs.find(codes[i & (codes.size() - 1)]);
+        if (index != invalid_glyph)
+        {
+            found += 1;
+            sum += font.glyphs.horizontal()[index].advance;
+        }
+    }
+    const double lookup_ms = elapsedMs(begin);
+    std::printf("find: %u lookups in %.3f ms, %.1f M lookups/s (%llu hits, checksum %g)\n",
+        lookups, lookup_ms, (double)lookups / lookup_ms / 1000.0, (unsigned long long)found, sum);
+    
+    // text batching, a frame of 256 lines of 64 glyphs each, utf-8 encoded
+    std::vector<std::string> lines(256);
+    for (auto& line : lines)
+    {
+        for (int i = 0; i < 64; i += 1)
+        {
+            const uint32_t code = font.glyphs.code()[rng() % font.glyphs.size()];
+            if (code < 0x80)
+            {
+                line.push_back((char)code);
+            }
+            else if (code < 0x800)
+            {
+                line.push_back((char)(0xC0 | (code >> 6)));
+                line.push_back((char)(0x80 | (code & 0x3F)));
+            }
+            else if (code < 0x10000)
+            {
+                line.push_back((char)(0xE0 | (code >> 12)));
+                line.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+                line.push_back((char)(0x80 | (code & 0x3F)));
+            }
+            else
+            {
+                line.push_back((char)(0xF0 | (code >> 18)));
+                line.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+                line.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+                line.push_back((char)(0x80 | (code & 0x3F)));
+            }
+        }
+    }
+    TextBatch batch;
+    batch.setTextureSize(atlas.textureWidth(), atlas.textureHeight());
+    const int frames = 200;
+    size_t glyphs = 0;
+    size_t commands = 0;
+    begin = clock_::now();
+    for (int frame = 0; frame < frames; frame += 1)
+    {
+        batch.clear();
+        float y = 0.0f;
+        for (auto& line : lines)
+        {
+            glyphs += batch.addText(font, line, 0.0f, y, 0xFFFFFFFF);
+            y += font.height;
+        }
+        batch.finish();
+        commands += batch.commands().size();
+    }
+    const double batch_ms = elapsedMs(begin);
+    std::printf("batch: %zu glyphs in %.3f ms, %.1f glyphs/ms, %.1f draws per frame\n",
+        glyphs, batch_ms, (double)glyphs / batch_ms, (double)commands / frames);
+    return 0;
+}